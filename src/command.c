@@ -26,8 +26,10 @@
 #include "exception.h"
 #include "command.h"
 #include "gdb_packet.h"
+#include "gdb_main.h"
 #include "target.h"
 #include "morse.h"
+#include "rtt.h"
 #include "version.h"
 
 #ifdef PLATFORM_HAS_TRACESWO
@@ -51,8 +53,14 @@ static bool cmd_swdp_scan(void);
 static bool cmd_targets(void);
 static bool cmd_morse(void);
 static bool cmd_halt_timeout(target *t, int argc, const char **argv);
+static bool cmd_poll_rate(target *t, int argc, const char **argv);
 static bool cmd_connect_srst(target *t, int argc, const char **argv);
 static bool cmd_hard_srst(void);
+static bool cmd_breakpoints(target *t, int argc, const char **argv);
+static bool cmd_rtt(target *t, int argc, const char **argv);
+static bool cmd_mem_cache(target *t, int argc, const char **argv);
+static bool cmd_flash_diff(target *t, int argc, const char **argv);
+static bool cmd_flash_mass_erase(target *t, int argc, const char **argv);
 #ifdef PLATFORM_HAS_POWER_SWITCH
 static bool cmd_target_power(target *t, int argc, const char **argv);
 #endif
@@ -71,8 +79,14 @@ const struct command_s cmd_list[] = {
 	{"targets", (cmd_handler)cmd_targets, "Display list of available targets" },
 	{"morse", (cmd_handler)cmd_morse, "Display morse error message" },
 	{"halt_timeout", (cmd_handler)cmd_halt_timeout, "Timeout (ms) to wait until Cortex-M is halted: (Default 2000)" },
+	{"poll_rate", (cmd_handler)cmd_poll_rate, "Halt poll interval (ms) while running: [(initial) (max)]" },
 	{"connect_srst", (cmd_handler)cmd_connect_srst, "Configure connect under SRST: (enable|disable)" },
 	{"hard_srst", (cmd_handler)cmd_hard_srst, "Force a pulse on the hard SRST line - disconnects target" },
+	{"breakpoints", (cmd_handler)cmd_breakpoints, "List breakpoint hit counts, ignore next hits: [(addr) (count)]" },
+	{"rtt", (cmd_handler)cmd_rtt, "RTT channels while running: (enable|disable) [control block address]" },
+	{"mem_cache", (cmd_handler)cmd_mem_cache, "Memory read cache, show hit counts: [(enable|disable)]" },
+	{"flash_diff", (cmd_handler)cmd_flash_diff, "Only erase and program changed flash blocks: [(enable|disable)]" },
+	{"flash_mass_erase", (cmd_handler)cmd_flash_mass_erase, "Mass erase banks a load erases at least this % of: [(percent)|enable|disable]" },
 #ifdef PLATFORM_HAS_POWER_SWITCH
 	{"tpwr", (cmd_handler)cmd_target_power, "Supplies power to the target: (enable|disable)"},
 #endif
@@ -301,6 +315,114 @@ static bool cmd_halt_timeout(target *t, int argc, const char **argv)
 	return true;
 }
 
+static bool cmd_poll_rate(target *t, int argc, const char **argv)
+{
+	(void)t;
+	if (argc > 2)
+		gdb_poll_rate(strtoul(argv[1], NULL, 0), strtoul(argv[2], NULL, 0));
+	else if (argc > 1)
+		gdb_poll_rate(0, strtoul(argv[1], NULL, 0));
+	gdb_poll_stats();
+	return true;
+}
+
+static bool cmd_breakpoints(target *t, int argc, const char **argv)
+{
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if (argc == 3) {
+		uint32_t addr = strtoul(argv[1], NULL, 0);
+		if (target_breakwatch_ignore(t, addr, strtoul(argv[2], NULL, 0))) {
+			gdb_outf("No breakpoint at 0x%08" PRIx32 "\n", addr);
+			return false;
+		}
+	}
+	target_breakwatch_info(t);
+	return true;
+}
+
+static bool cmd_rtt(target *t, int argc, const char **argv)
+{
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if (argc > 1) {
+		bool enable;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		if (!enable)
+			rtt_disable();
+		else if (!rtt_enable(t, (argc > 2) ? strtoul(argv[2], NULL, 0) : 0))
+			return false;
+	}
+	rtt_status(t);
+	return true;
+}
+
+static bool cmd_mem_cache(target *t, int argc, const char **argv)
+{
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if (argc > 1) {
+		bool enable;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		target_mem_cache_enable(t, enable);
+	}
+	target_mem_cache_info(t);
+	return true;
+}
+
+static bool cmd_flash_diff(target *t, int argc, const char **argv)
+{
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if (argc > 1) {
+		bool enable;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return false;
+		target_flash_diff_enable(t, enable);
+	}
+	gdb_outf("Differential flash programming: %s\n",
+	         target_flash_diff_enabled(t) ? "enabled" : "disabled");
+	return true;
+}
+
+static bool cmd_flash_mass_erase(target *t, int argc, const char **argv)
+{
+	if (!t) {
+		gdb_out("No target attached\n");
+		return false;
+	}
+	if (argc > 1) {
+		char *end;
+		unsigned long percent = strtoul(argv[1], &end, 0);
+		if (end == argv[1]) {
+			bool enable;
+			if (!parse_enable_or_disable(argv[1], &enable))
+				return false;
+			percent = enable ? 100 : 0;
+		} else if (*end || (percent > 100)) {
+			gdb_out("Expected a percentage from 0 to 100\n");
+			return false;
+		}
+		target_flash_mass_erase_set(t, percent);
+	}
+	if (target_flash_mass_erase_get(t))
+		gdb_outf("Mass erase banks a load erases %u%% of\n",
+		         target_flash_mass_erase_get(t));
+	else
+		gdb_out("Mass erase planning disabled\n");
+	return true;
+}
+
 static bool cmd_hard_srst(void)
 {
 	target_list_free();
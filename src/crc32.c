@@ -111,6 +111,16 @@ uint32_t generic_crc32(target *t, uint32_t base, size_t len)
 	}
 	return crc;
 }
+
+uint32_t crc32_buf(const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	uint32_t crc = -1;
+
+	while (len--)
+		crc = crc32_calc(crc, *data++);
+	return crc;
+}
 #else
 #include <libopencm3/stm32/crc.h>
 uint32_t generic_crc32(target *t, uint32_t base, size_t len)
@@ -146,5 +156,103 @@ uint32_t generic_crc32(target *t, uint32_t base, size_t len)
 	}
 	return crc;
 }
+
+uint32_t crc32_buf(const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	uint32_t crc;
+
+	CRC_CR |= CRC_CR_RESET;
+
+	for (; len > 3; len -= 4, data += 4) {
+		uint32_t word;
+		memcpy(&word, data, sizeof(word));
+		CRC_DR = __builtin_bswap32(word);
+	}
+
+	crc = CRC_DR;
+
+	while (len--) {
+		crc ^= *data++ << 24;
+		for (int i = 0; i < 8; i++) {
+			if (crc & 0x80000000)
+				crc = (crc << 1) ^ 0x4C11DB7;
+			else
+				crc <<= 1;
+		}
+	}
+	return crc;
+}
 #endif
 
+/* Continue a CRC over len more bytes.  Only used for short runs. */
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+
+	while (len--) {
+		crc ^= *data++ << 24;
+		for (int i = 0; i < 8; i++) {
+			if (crc & 0x80000000)
+				crc = (crc << 1) ^ 0x4C11DB7;
+			else
+				crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+/* a * b modulo the CRC polynomial */
+static uint32_t crc32_mulmod(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0;
+
+	for (int i = 31; i >= 0; i--) {
+		if (r & 0x80000000)
+			r = (r << 1) ^ 0x4C11DB7;
+		else
+			r <<= 1;
+		if (b & (1u << i))
+			r ^= a;
+	}
+	return r;
+}
+
+/* Continue a CRC over len zero bytes, i.e. crc * x^(8 * len), without
+ * touching each byte.  As the CRC is linear in its initial value, this
+ * lets a CRC computed from one initial value be moved to another:
+ * crc(a, data) == crc(b, data) ^ crc32_zeros(a ^ b, len).
+ */
+uint32_t crc32_zeros(uint32_t crc, size_t len)
+{
+	uint32_t base = 0x100;	/* x^8 */
+	uint32_t shift = 1;
+
+	for (; len; len >>= 1) {
+		if (len & 1)
+			shift = crc32_mulmod(shift, base);
+		base = crc32_mulmod(base, base);
+	}
+	return crc32_mulmod(crc, shift);
+}
+
+/* The reflected IEEE 802.3 CRC-32 without the final XOR, as computed by
+ * some debug units.  It cannot be converted to GDB's CRC-32, so it is
+ * only used to compare the target against data held here.
+ */
+uint32_t crc32_ieee_buf(const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	uint32_t crc = -1;
+
+	while (len--) {
+		crc ^= *data++;
+		for (int i = 0; i < 8; i++) {
+			if (crc & 1)
+				crc = (crc >> 1) ^ 0xEDB88320;
+			else
+				crc >>= 1;
+		}
+	}
+	return crc;
+}
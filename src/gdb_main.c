@@ -32,8 +32,8 @@
 #include "gdb_hostio.h"
 #include "target.h"
 #include "command.h"
-#include "crc32.h"
 #include "morse.h"
+#include "rtt.h"
 
 enum gdb_signal {
 	GDB_SIGINT = 2,
@@ -44,11 +44,29 @@ enum gdb_signal {
 
 #define BUF_SIZE	1024
 
+/* Both Cortex-M and Cortex-A report the PC as register 15 */
+#define GDB_REG_PC	15
+
 #define ERROR_IF_NO_TARGET()	\
 	if(!cur_target) { gdb_putpacketz("EFF"); break; }
 
 static char pbuf[BUF_SIZE+1];
 
+/* Halt polling while the target runs.  Polls start at initial_ms after a
+ * resume and the interval doubles while nothing happens, up to max_ms.  A
+ * sleeping core goes straight to max_ms and RTT traffic brings the rate
+ * back up.  GDB input always ends the wait early. */
+static struct {
+	uint32_t initial_ms;
+	uint32_t max_ms;
+	uint32_t polls;
+	uint32_t sleeping;
+	uint32_t run_ms;
+} poll = {
+	.initial_ms = 0,
+	.max_ms = 20,
+};
+
 static target *cur_target;
 static target *last_target;
 
@@ -95,12 +113,34 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 {
 	int size;
 	bool single_step = false;
+	uint32_t range_start = 0, range_end = 0;
 
 	/* GDB protocol main loop */
 	while(1) {
 		SET_IDLE_STATE(1);
 		size = gdb_getpacket(pbuf, BUF_SIZE);
 		SET_IDLE_STATE(0);
+
+		/* 'vCont;action[:thread]': only one thread, so take the first
+		 * action and handle it like the equivalent 's' or 'c'. */
+		if (!strncmp(pbuf, "vCont;", 6)) {
+			switch (pbuf[6]) {
+			case 'r':	/* 'r start,end': Step while start <= pc < end */
+				if (sscanf(pbuf + 7, "%" SCNx32 ",%" SCNx32,
+				           &range_start, &range_end) != 2)
+					break;
+				/* fall through */
+			case 's':
+			case 'S':
+				pbuf[0] = 's';
+				break;
+			case 'c':
+			case 'C':
+				pbuf[0] = 'c';
+				break;
+			}
+		}
+
 		switch(pbuf[0]) {
 		/* Implementation of these is mandatory! */
 		case 'g': { /* 'g': Read general registers */
@@ -179,14 +219,58 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 
 			/* Wait for target halt */
-			while(!(reason = target_halt_poll(cur_target, &watch))) {
-				unsigned char c = gdb_if_getchar_to(0);
+			bool interrupted = false;
+			uint32_t interval = poll.initial_ms;
+			uint32_t run_start = platform_time_ms();
+			while(1) {
+				reason = target_halt_poll(cur_target, &watch);
+				poll.polls++;
+				if ((reason == TARGET_HALT_STEPPING) &&
+				    (range_start < range_end)) {
+					/* Keep stepping until the PC leaves the range,
+					 * GDB only needs to see the final stop. */
+					uint32_t pc;
+					if ((target_reg_read(cur_target, GDB_REG_PC, &pc, sizeof(pc)) == 4) &&
+					    (pc >= range_start) && (pc < range_end)) {
+						target_halt_resume(cur_target, true);
+						interval = poll.initial_ms;
+						/* Only look for an interrupt, don't wait */
+						unsigned char c = gdb_if_getchar_to(0);
+						if ((c == '\x03') || (c == '\x04')) {
+							target_halt_request(cur_target);
+							interrupted = true;
+							range_start = range_end = 0;
+						}
+						continue;
+					}
+				}
+				/* Drain RTT output, also once after the halt */
+				bool active = rtt_poll(cur_target);
+				if (reason != TARGET_HALT_RUNNING)
+					break;
+				if (target_sleeping(cur_target)) {
+					poll.sleeping++;
+					interval = poll.max_ms;
+				} else if (active) {
+					interval = poll.initial_ms;
+				} else {
+					interval = MIN(MAX(interval * 2, 1), poll.max_ms);
+				}
+				unsigned char c = gdb_if_getchar_to(interval);
 				if((c == '\x03') || (c == '\x04')) {
 					target_halt_request(cur_target);
+					interrupted = range_start < range_end;
+					range_start = range_end = 0;
 				}
 			}
+			range_start = range_end = 0;
+			poll.run_ms += platform_time_ms() - run_start;
 			SET_RUN_STATE(0);
 
+			/* A range step cut short by the user is an interrupt */
+			if (interrupted && (reason == TARGET_HALT_STEPPING))
+				reason = TARGET_HALT_REQUEST;
+
 			/* Translate reason to GDB signal */
 			switch (reason) {
 			case TARGET_HALT_ERROR:
@@ -317,10 +401,55 @@ handle_q_string_reply(const char *str, const char *param)
 		gdb_putpacketz("E01");
 }
 
+#define SEARCH_BLOCK	1024
+
+/* Search target memory for a pattern, reading it in large blocks.  The
+ * last plen - 1 bytes of each block are kept so matches straddling a
+ * block boundary are found.  Returns 1 and sets *found on a match, 0 if
+ * there is none, -1 if the memory can't be read. */
+static int search_memory(target *t, uint32_t addr, uint32_t len,
+                         const uint8_t *pattern, size_t plen, uint32_t *found)
+{
+	if ((plen == 0) || (plen > len))
+		return 0;
+
+	uint8_t buf[SEARCH_BLOCK + plen - 1];
+	uint32_t base = addr;	/* target address of buf[0] */
+	size_t have = 0;
+
+	while (len) {
+		size_t chunk = MIN(len, SEARCH_BLOCK);
+		if (target_mem_read(t, buf + have, addr, chunk))
+			return -1;
+		addr += chunk;
+		len -= chunk;
+		have += chunk;
+
+		for (size_t i = 0; i + plen <= have; i++) {
+			uint8_t *p = memchr(buf + i, pattern[0], have - plen + 1 - i);
+			if (!p)
+				break;
+			i = p - buf;
+			if (!memcmp(p, pattern, plen)) {
+				*found = base + i;
+				return 1;
+			}
+		}
+
+		/* Carry the tail over to the next block */
+		size_t keep = MIN(have, plen - 1);
+		memmove(buf, buf + have - keep, keep);
+		base += have - keep;
+		have = keep;
+	}
+	return 0;
+}
+
 static void
 handle_q_packet(char *packet, int len)
 {
 	uint32_t addr, alen;
+	int pat = 0;
 
 	if(!strncmp(packet, "qRcmd,", 6)) {
 		char *data;
@@ -343,7 +472,8 @@ handle_q_packet(char *packet, int len)
 
 	} else if (!strncmp (packet, "qSupported", 10)) {
 		/* Query supported protocol features */
-		gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+", BUF_SIZE);
+		gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+;"
+		                "ConditionalBreakpoints+", BUF_SIZE);
 
 	} else if (strncmp (packet, "qXfer:memory-map:read::", 23) == 0) {
 		/* Read target XML memory map */
@@ -377,7 +507,27 @@ handle_q_packet(char *packet, int len)
 			gdb_putpacketz("E01");
 			return;
 		}
-		gdb_putpacket_f("C%lx", generic_crc32(cur_target, addr, alen));
+		gdb_putpacket_f("C%lx", target_crc32(cur_target, addr, alen));
+
+	} else if (sscanf(packet, "qSearch:memory:%" SCNx32 ";%" SCNx32 ";%n",
+	                  &addr, &alen, &pat) == 2) {
+		/* The pattern is binary data after the second ';' */
+		uint32_t found;
+		if(!cur_target) {
+			gdb_putpacketz("E01");
+			return;
+		}
+		switch (search_memory(cur_target, addr, alen, (uint8_t *)packet + pat,
+		                      len - pat, &found)) {
+		case 1:
+			gdb_putpacket_f("1,%" PRIx32, found);
+			break;
+		case 0:
+			gdb_putpacketz("0");
+			break;
+		default:
+			gdb_putpacketz("E01");
+		}
 
 	} else {
 		DEBUG("*** Unsupported packet: %s\n", packet);
@@ -392,7 +542,11 @@ handle_v_packet(char *packet, int plen)
 	int bin;
 	static uint8_t flash_mode = 0;
 
-	if (sscanf(packet, "vAttach;%08lx", &addr) == 1) {
+	if (!strcmp(packet, "vCont?")) {
+		/* Resume actions handled in gdb_main_loop() */
+		gdb_putpacketz("vCont;c;C;s;S;r");
+
+	} else if (sscanf(packet, "vAttach;%08lx", &addr) == 1) {
 		/* Attach to remote target processor */
 		cur_target = target_attach_n(addr, &gdb_controller);
 		if(cur_target)
@@ -473,6 +627,22 @@ handle_z_packet(char *packet, int plen)
 	else
 		ret = target_breakwatch_clear(cur_target, type, addr, len);
 
+	/* Breakpoint conditions follow as a list of 'X len,bytecode' */
+	char *cond = strchr(packet, ';');
+	if (set && (ret == 0) && cond) {
+		cond++;
+		while (*cond == 'X') {
+			char *hex;
+			size_t clen = strtoul(cond + 1, &hex, 16);
+			if ((*hex != ',') || (strlen(hex + 1) < clen * 2))
+				break;
+			uint8_t bytecode[clen];
+			unhexify(bytecode, hex + 1, clen);
+			target_breakwatch_cond(cur_target, type, addr, len, bytecode, clen);
+			cond = hex + 1 + clen * 2;
+		}
+	}
+
 	if (ret < 0) {
 		gdb_putpacketz("E01");
 	} else if (ret > 0) {
@@ -486,3 +656,17 @@ void gdb_main(void)
 {
 	gdb_main_loop(&gdb_controller, false);
 }
+
+void gdb_poll_rate(uint32_t initial_ms, uint32_t max_ms)
+{
+	poll.initial_ms = initial_ms;
+	poll.max_ms = MAX(initial_ms, max_ms);
+}
+
+void gdb_poll_stats(void)
+{
+	gdb_outf("Halt poll interval %"PRIu32" ms after resume, up to %"PRIu32" ms\n",
+	         poll.initial_ms, poll.max_ms);
+	gdb_outf("%"PRIu32" polls in %"PRIu32" ms running, %"PRIu32" while sleeping\n",
+	         poll.polls, poll.run_ms, poll.sleeping);
+}
@@ -21,6 +21,10 @@
 #ifndef __CRC32_H
 #define __CRC32_H
 
-uint32_t generic_crc32(target *t, uint32_t base, int len);
+uint32_t generic_crc32(target *t, uint32_t base, size_t len);
+uint32_t crc32_buf(const void *buf, size_t len);
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+uint32_t crc32_zeros(uint32_t crc, size_t len);
+uint32_t crc32_ieee_buf(const void *buf, size_t len);
 
 #endif
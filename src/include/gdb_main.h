@@ -22,6 +22,8 @@
 #define __GDB_MAIN_H
 
 void gdb_main(void);
+void gdb_poll_rate(uint32_t initial_ms, uint32_t max_ms);
+void gdb_poll_stats(void);
 
 #endif
 
@@ -0,0 +1,39 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RTT_H
+#define __RTT_H
+
+#include "target.h"
+
+/* Real Time Transfer: ring buffers in target RAM described by a control
+ * block starting with the "SEGGER RTT" ID string, read and written while
+ * the target runs. */
+bool rtt_enable(target *t, target_addr cb);
+void rtt_disable(void);
+void rtt_status(target *t);
+bool rtt_poll(target *t);
+
+/* Implemented by the platform, moving channel data to and from the host.
+ * Both return the number of bytes accepted or delivered. */
+void rtt_if_enable(bool enable);
+int rtt_if_write(unsigned channel, const void *buf, size_t len);
+int rtt_if_read(unsigned channel, void *buf, size_t len);
+
+#endif
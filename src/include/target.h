@@ -52,16 +52,24 @@ const char *target_core_name(target *t);
 bool target_mem_map(target *t, char *buf, size_t len);
 int target_mem_read(target *t, void *dest, target_addr src, size_t len);
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len);
+uint32_t target_crc32(target *t, target_addr addr, size_t len);
+void target_mem_cache_enable(target *t, bool enable);
+void target_mem_cache_info(target *t);
 /* Flash memory access functions */
 int target_flash_erase(target *t, target_addr addr, size_t len);
 int target_flash_write(target *t, target_addr dest, const void *src, size_t len);
 int target_flash_done(target *t);
+void target_flash_diff_enable(target *t, bool enable);
+bool target_flash_diff_enabled(target *t);
+void target_flash_mass_erase_set(target *t, unsigned percent);
+unsigned target_flash_mass_erase_get(target *t);
 
 /* Register access functions */
 size_t target_regs_size(target *t);
 const char *target_tdesc(target *t);
 void target_regs_read(target *t, void *data);
 void target_regs_write(target *t, const void *data);
+ssize_t target_reg_read(target *t, int reg, void *data, size_t max);
 
 /* Halt/resume functions */
 enum target_halt_reason {
@@ -77,6 +85,7 @@ enum target_halt_reason {
 void target_reset(target *t);
 void target_halt_request(target *t);
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch);
+bool target_sleeping(target *t);
 void target_halt_resume(target *t, bool step);
 
 /* Break-/watchpoint functions */
@@ -89,6 +98,10 @@ enum target_breakwatch {
 };
 int target_breakwatch_set(target *t, enum target_breakwatch, target_addr, size_t);
 int target_breakwatch_clear(target *t, enum target_breakwatch, target_addr, size_t);
+int target_breakwatch_cond(target *t, enum target_breakwatch, target_addr, size_t,
+                           const uint8_t *bytecode, size_t len);
+int target_breakwatch_ignore(target *t, target_addr addr, uint32_t count);
+void target_breakwatch_info(target *t);
 
 /* Command interpreter */
 void target_command_help(target *t);
@@ -68,6 +68,8 @@ void adiv5_jtag_dp_handler(jtag_dev_t *dev)
 	dp->error = stlink_dp_error;
 	dp->low_access = stlink_dp_low_access;
 	dp->abort = stlink_dp_abort;
+	dp->core_regs_read = stlink_core_regs_read;
+	dp->core_regs_write = stlink_core_regs_write;
 
 	adiv5_dp_init(dp);
 }
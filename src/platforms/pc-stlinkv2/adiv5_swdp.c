@@ -40,6 +40,8 @@ int adiv5_swdp_scan(void)
 	dp->error = stlink_dp_error;
 	dp->low_access = stlink_dp_low_access;
 	dp->abort = stlink_dp_abort;
+	dp->core_regs_read = stlink_core_regs_read;
+	dp->core_regs_write = stlink_core_regs_write;
 
 	stlink_dp_error(dp);
 	adiv5_dp_init(dp);
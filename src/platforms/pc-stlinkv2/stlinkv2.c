@@ -1042,6 +1042,8 @@ uint32_t stlink_dp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 {
 	uint32_t response = 0;
 	int res;
+	if (dp->sticky_error)
+		return 0;
 	if (RnW) {
 		res = stlink_read_dp_register(
 			STLINK_DEBUG_PORT_ACCESS, addr, &response);
@@ -1052,15 +1054,19 @@ uint32_t stlink_dp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 					 addr, value);
 		res = stlink_write_dp_register(STLINK_DEBUG_PORT_ACCESS, addr, value);
 	}
-	if (res == STLINK_ERROR_WAIT)
-		raise_exception(EXCEPTION_TIMEOUT, "DP ACK timeout");
+	if (res == STLINK_ERROR_WAIT) {
+		adiv5_dp_raise(dp, EXCEPTION_TIMEOUT, "DP ACK timeout");
+		return 0;
+	}
 
 	if(res == STLINK_ERROR_DP_FAULT) {
 		dp->fault = 1;
 		return 0;
 	}
-	if(res == STLINK_ERROR_FAIL)
-		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	if(res == STLINK_ERROR_FAIL) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+		return 0;
+	}
 
 	return response;
 }
@@ -1250,12 +1256,49 @@ void stlink_reg_write(ADIv5_AP_t *ap, int num, uint32_t val)
 	stlink_usb_error_check(res, true);
 }
 
+/* READALLREGS returns r0-r15, xPSR, MSP, PSP and the special register
+ * word in this order, use it if the caller asks for them first. */
+static const uint32_t stlink_allregs_sel[] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	0x10, 0x11, 0x12, 0x14
+};
+
+bool stlink_core_regs_read(ADIv5_AP_t *ap, const uint32_t *regsel,
+                           uint32_t *regs, size_t n)
+{
+	size_t i = 0;
+	const size_t nall = sizeof(stlink_allregs_sel) / 4;
+	if ((n >= nall) && !memcmp(regsel, stlink_allregs_sel, sizeof(stlink_allregs_sel))) {
+		uint32_t all[21];
+		stlink_regs_read(ap, all);
+		memcpy(regs, all, sizeof(stlink_allregs_sel));
+		i = nall;
+	}
+	for (; i < n; i++)
+		regs[i] = stlink_reg_read(ap, regsel[i]);
+	return true;
+}
+
+void stlink_core_regs_write(ADIv5_AP_t *ap, const uint32_t *regsel,
+                            const uint32_t *regs, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		stlink_reg_write(ap, regsel[i], regs[i]);
+}
+
 void
 adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
 	stlink_readmem(ap, dest, src, len);
 }
 
+void adiv5_mem_read_repeat(ADIv5_AP_t *ap, uint32_t *dest, uint32_t src,
+                           size_t count)
+{
+	while (count--)
+		stlink_readmem(ap, dest++, src, 4);
+}
+
 void
 adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 					  size_t len, enum align align)
@@ -1274,6 +1317,13 @@ adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 	}
 }
 
+void adiv5_mem_write_repeat(ADIv5_AP_t *ap, uint32_t dest, const uint32_t *src,
+                            size_t count)
+{
+	while (count--)
+		stlink_writemem32(ap, dest, 4, (uint32_t *)src++);
+}
+
 void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
 	stlink_write_dp_register(ap->apsel, addr, value);
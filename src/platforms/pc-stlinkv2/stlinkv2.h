@@ -47,6 +47,10 @@ int stlink_usb_get_rw_status(void);
 void stlink_regs_read(ADIv5_AP_t *ap, void *data);
 uint32_t stlink_reg_read(ADIv5_AP_t *ap, int idx);
 void stlink_reg_write(ADIv5_AP_t *ap, int num, uint32_t val);
+bool stlink_core_regs_read(ADIv5_AP_t *ap, const uint32_t *regsel,
+                           uint32_t *regs, size_t n);
+void stlink_core_regs_write(ADIv5_AP_t *ap, const uint32_t *regsel,
+                            const uint32_t *regs, size_t n);
 extern  int debug_level;
 # define DEBUG_STLINK if (debug_level > 0) printf
 # define DEBUG_USB    if (debug_level > 1) printf
@@ -0,0 +1,143 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file exposes RTT channels as TCP servers, channel n listens on
+ * port 19021 + n like other RTT hosts do.  Everything is polled without
+ * blocking from the GDB wait loop.
+ */
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+#   include <winsock2.h>
+#   include <windows.h>
+#   include <ws2tcpip.h>
+#else
+#   include <sys/socket.h>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <sys/select.h>
+#endif
+
+#include <unistd.h>
+
+#include "general.h"
+#include "rtt.h"
+
+#define RTT_PORT	19021
+#define RTT_IF_CHANNELS	4
+
+static int rtt_serv[RTT_IF_CHANNELS] = {-1, -1, -1, -1};
+static int rtt_conn[RTT_IF_CHANNELS] = {-1, -1, -1, -1};
+
+static bool rtt_if_ready(int fd, bool write)
+{
+	fd_set fds;
+# if defined(__CYGWIN__)
+	TIMEVAL tv = {0, 0};
+#else
+	struct timeval tv = {0, 0};
+#endif
+
+	FD_ZERO(&fds);
+	FD_SET(fd, &fds);
+	return select(fd + 1, write ? NULL : &fds, write ? &fds : NULL,
+	              NULL, &tv) > 0;
+}
+
+static int rtt_if_listen(int port)
+{
+	struct sockaddr_in addr;
+	int opt = 1;
+	int fd = socket(PF_INET, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if ((setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt)) == -1) ||
+	    (bind(fd, (void*)&addr, sizeof(addr)) == -1) ||
+	    (listen(fd, 1) == -1)) {
+		close(fd);
+		return -1;
+	}
+	DEBUG("RTT listening on TCP: %4d\n", port);
+	return fd;
+}
+
+static void rtt_if_drop(unsigned channel)
+{
+	if (rtt_conn[channel] != -1)
+		close(rtt_conn[channel]);
+	rtt_conn[channel] = -1;
+}
+
+void rtt_if_enable(bool enable)
+{
+	for (unsigned i = 0; i < RTT_IF_CHANNELS; i++) {
+		if (enable && (rtt_serv[i] == -1)) {
+			rtt_serv[i] = rtt_if_listen(RTT_PORT + i);
+		} else if (!enable) {
+			rtt_if_drop(i);
+			if (rtt_serv[i] != -1)
+				close(rtt_serv[i]);
+			rtt_serv[i] = -1;
+		}
+	}
+}
+
+/* Connection for a channel, accepting a pending one if needed */
+static int rtt_if_conn(unsigned channel)
+{
+	if (channel >= RTT_IF_CHANNELS)
+		return -1;
+	if ((rtt_conn[channel] == -1) && (rtt_serv[channel] != -1) &&
+	    rtt_if_ready(rtt_serv[channel], false)) {
+		rtt_conn[channel] = accept(rtt_serv[channel], NULL, NULL);
+		DEBUG("RTT channel %u connected\n", channel);
+	}
+	return rtt_conn[channel];
+}
+
+int rtt_if_write(unsigned channel, const void *buf, size_t len)
+{
+	int fd = rtt_if_conn(channel);
+	if ((fd == -1) || !rtt_if_ready(fd, true))
+		return 0;
+
+	int n = send(fd, buf, len, 0);
+	if (n <= 0) {
+		rtt_if_drop(channel);
+		return 0;
+	}
+	return n;
+}
+
+int rtt_if_read(unsigned channel, void *buf, size_t len)
+{
+	int fd = rtt_if_conn(channel);
+	if ((fd == -1) || !len || !rtt_if_ready(fd, false))
+		return 0;
+
+	int n = recv(fd, buf, len, 0);
+	if (n <= 0) {
+		rtt_if_drop(channel);
+		return 0;
+	}
+	return n;
+}
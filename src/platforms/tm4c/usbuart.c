@@ -21,6 +21,7 @@
  */
 #include "general.h"
 #include "cdcacm.h"
+#include "rtt.h"
 
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/cm3/scs.h>
@@ -38,6 +39,13 @@ static uint8_t buf_rx_in;
 /* Fifo out pointer, writes assumed to be atomic, should be only incremented outside RX ISR */
 static uint8_t buf_rx_out;
 
+/* While RTT is enabled the UART endpoint carries RTT channel 0 instead,
+ * host data is queued here until the next poll picks it up */
+static volatile bool rtt_active;
+static uint8_t rtt_rx[FIFO_SIZE];
+static volatile uint8_t rtt_rx_in;
+static volatile uint8_t rtt_rx_out;
+
 void usbuart_init(void)
 {
 	UART_PIN_SETUP();
@@ -107,10 +115,46 @@ void usbuart_usb_out_cb(usbd_device *dev, uint8_t ep)
 	int len = usbd_ep_read_packet(dev, CDCACM_UART_ENDPOINT,
 					buf, CDCACM_PACKET_SIZE);
 
+	if (rtt_active) {
+		for (int i = 0; i < len; i++) {
+			if (((rtt_rx_in + 1) % FIFO_SIZE) == rtt_rx_out)
+				break;
+			rtt_rx[rtt_rx_in] = buf[i];
+			rtt_rx_in = (rtt_rx_in + 1) % FIFO_SIZE;
+		}
+		return;
+	}
+
 	for(int i = 0; i < len; i++)
 		uart_send_blocking(USBUART, buf[i]);
 }
 
+void rtt_if_enable(bool enable)
+{
+	rtt_rx_out = rtt_rx_in;
+	rtt_active = enable;
+}
+
+int rtt_if_write(unsigned channel, const void *buf, size_t len)
+{
+	if (channel || (cdcacm_get_config() != 1))
+		return 0;
+	return usbd_ep_write_packet(usbdev, CDCACM_UART_ENDPOINT, buf,
+	                            MIN(len, CDCACM_PACKET_SIZE));
+}
+
+int rtt_if_read(unsigned channel, void *buf, size_t len)
+{
+	size_t n = 0;
+	if (channel)
+		return 0;
+	while ((n < len) && (rtt_rx_out != rtt_rx_in)) {
+		((uint8_t *)buf)[n++] = rtt_rx[rtt_rx_out];
+		rtt_rx_out = (rtt_rx_out + 1) % FIFO_SIZE;
+	}
+	return n;
+}
+
 
 void usbuart_usb_in_cb(usbd_device *dev, uint8_t ep)
 {
@@ -149,8 +193,8 @@ void USBUART_ISR(void)
 	}
 
 	if (flush) {
-		/* forcibly empty fifo if no USB endpoint */
-		if (cdcacm_get_config() != 1)
+		/* forcibly empty fifo if no USB endpoint, or RTT owns it */
+		if ((cdcacm_get_config() != 1) || rtt_active)
 		{
 			buf_rx_out = buf_rx_in;
 			return;
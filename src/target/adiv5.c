@@ -248,6 +248,17 @@ void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
 }
 
+/* Report a transport error from a low_access implementation */
+void adiv5_dp_raise(ADIv5_DP_t *dp, uint32_t type, const char *msg)
+{
+	if (!(dp->sticky_mask & type))
+		raise_exception(type, msg);
+	if (!dp->sticky_error) {
+		DEBUG("Deferred: %s\n", msg);
+		dp->sticky_error = type;
+	}
+}
+
 static uint32_t adiv5_mem_read32(ADIv5_AP_t *ap, uint32_t addr)
 {
 	uint32_t ret;
@@ -390,8 +401,6 @@ static bool adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 	}
 	return res;
 }
-bool adiv5_ap_setup(int i);
-void adiv5_ap_cleanup(int i);
 
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 {
@@ -433,14 +442,12 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 void adiv5_dp_init(ADIv5_DP_t *dp)
 {
 	volatile bool probed = false;
-	volatile uint32_t ctrlstat = 0;
+	uint32_t ctrlstat;
 	adiv5_dp_ref(dp);
 
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
-	}
-	if (e.type) {
+	adiv5_dp_sticky_begin(dp, EXCEPTION_TIMEOUT);
+	ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
+	if (adiv5_dp_sticky_end(dp)) {
 		DEBUG("DP not responding!  Trying abort sequence...\n");
 		adiv5_dp_abort(dp, ADIV5_DP_ABORT_DAPABORT);
 		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
@@ -601,6 +608,24 @@ void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 	extract(dest, src, tmp, align);
 }
 
+/* Read the same word 'count' times without address increment, for
+ * sampling registers like DWT_PCSR at full link speed */
+void adiv5_mem_read_repeat(ADIv5_AP_t *ap, uint32_t *dest, uint32_t src,
+                           size_t count)
+{
+	if (count == 0)
+		return;
+
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_ADDRINC_NONE |
+	                                 ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+	while (--count)
+		*dest++ = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ,
+		                              ADIV5_AP_DRW, 0);
+	*dest = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+}
+
 void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 					  size_t len, enum align align)
 {
@@ -636,6 +661,19 @@ void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 	}
 }
 
+/* Write 'count' words to the same address without address increment, for
+ * streaming operations into a fixed register like the cache maintenance
+ * ones */
+void adiv5_mem_write_repeat(ADIv5_AP_t *ap, uint32_t dest, const uint32_t *src,
+                            size_t count)
+{
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_ADDRINC_NONE |
+	                                 ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
+	while (count--)
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, *src++);
+}
+
 void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
 	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT,
@@ -117,6 +117,17 @@
 #define ADIV5_ROM_ROMENTRY_PRESENT  (1u << 0)
 #define ADIV5_ROM_ROMENTRY_OFFSET	(0xFFFFF000u)
 
+/* JEP-106 designer codes from the component PIDR, continuation code
+ * in bits 11:8 */
+#define ADIV5_DESIGNER_FREESCALE	0x00e
+#define ADIV5_DESIGNER_NXP		0x015
+#define ADIV5_DESIGNER_TEXAS		0x017
+#define ADIV5_DESIGNER_ATMEL		0x01f
+#define ADIV5_DESIGNER_STM		0x020
+#define ADIV5_DESIGNER_NORDIC		0x244
+#define ADIV5_DESIGNER_ARM		0x43b
+#define ADIV5_DESIGNER_ENERGY_MICRO	0x673
+
 
 /* Constants to make RnW parameters more clear in code */
 #define ADIV5_LOW_WRITE		0
@@ -129,6 +140,8 @@ enum align {
 	ALIGN_DWORD    = 3
 };
 
+struct ADIv5_AP_s;
+
 /* Try to keep this somewhat absract for later adding SW-DP */
 typedef struct ADIv5_DP_s {
 	int refcnt;
@@ -142,6 +155,18 @@ typedef struct ADIv5_DP_s {
 	uint32_t (*low_access)(struct ADIv5_DP_s *dp, uint8_t RnW,
                                uint16_t addr, uint32_t value);
 	void (*abort)(struct ADIv5_DP_s *dp, uint32_t abort);
+	/* Transport errors in sticky_mask are recorded in sticky_error
+	 * rather than raised, see adiv5_dp_sticky_begin() */
+	uint32_t sticky_mask;
+	uint32_t sticky_error;
+	/* Optional block transfer of Cortex-M core registers, selected by
+	 * their DCRSR REGSEL value.  Reads return false if the result
+	 * can't be trusted and the caller should fall back to single
+	 * register transfers. */
+	bool (*core_regs_read)(struct ADIv5_AP_s *ap, const uint32_t *regsel,
+	                       uint32_t *regs, size_t n);
+	void (*core_regs_write)(struct ADIv5_AP_s *ap, const uint32_t *regsel,
+	                        const uint32_t *regs, size_t n);
 
 	union {
 		jtag_dev_t *dev;
@@ -184,7 +209,28 @@ typedef struct ADIv5_AP_s {
 
 void adiv5_dp_init(ADIv5_DP_t *dp);
 void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+void adiv5_dp_raise(ADIv5_DP_t *dp, uint32_t type, const char *msg);
+
+/* Sticky error mode: transport errors of the exception types in mask
+ * don't longjmp out of the transfer.  The first one is recorded, later
+ * DP/AP accesses are skipped, and adiv5_dp_sticky_end() returns it so
+ * the caller can check a whole batch at once.  Doesn't nest. */
+static inline void adiv5_dp_sticky_begin(ADIv5_DP_t *dp, uint32_t mask)
+{
+	dp->sticky_mask = mask;
+	dp->sticky_error = 0;
+}
+
+static inline uint32_t adiv5_dp_sticky_end(ADIv5_DP_t *dp)
+{
+	uint32_t err = dp->sticky_error;
+	dp->sticky_mask = 0;
+	dp->sticky_error = 0;
+	return err;
+}
 
+bool adiv5_ap_setup(int i);
+void adiv5_ap_cleanup(int i);
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel);
 void adiv5_dp_ref(ADIv5_DP_t *dp);
 void adiv5_ap_ref(ADIv5_AP_t *ap);
@@ -197,8 +243,12 @@ uint32_t adiv5_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 void adiv5_jtag_dp_handler(jtag_dev_t *dev);
 
 void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
+void adiv5_mem_read_repeat(ADIv5_AP_t *ap, uint32_t *dest, uint32_t src,
+                           size_t count);
 void adiv5_mem_write(ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len);
 void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 						   size_t len, enum align align);
+void adiv5_mem_write_repeat(ADIv5_AP_t *ap, uint32_t dest, const uint32_t *src,
+                            size_t count);
 
 #endif
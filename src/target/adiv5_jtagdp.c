@@ -28,6 +28,7 @@
 #include "jtag_scan.h"
 #include "jtagtap.h"
 #include "morse.h"
+#include "cortexm.h"
 
 #define JTAGDP_ACK_OK	0x02
 #define JTAGDP_ACK_WAIT	0x01
@@ -46,6 +47,9 @@ static uint32_t adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 
 static void adiv5_jtagdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 
+static bool adiv5_jtagdp_core_regs_read(ADIv5_AP_t *ap, const uint32_t *regsel,
+                                        uint32_t *regs, size_t n);
+
 void adiv5_jtag_dp_handler(jtag_dev_t *dev)
 {
 	ADIv5_DP_t *dp = (void*)calloc(1, sizeof(*dp));
@@ -61,6 +65,7 @@ void adiv5_jtag_dp_handler(jtag_dev_t *dev)
 	dp->error = adiv5_jtagdp_error;
 	dp->low_access = adiv5_jtagdp_low_access;
 	dp->abort = adiv5_jtagdp_abort;
+	dp->core_regs_read = adiv5_jtagdp_core_regs_read;
 
 	adiv5_dp_init(dp);
 }
@@ -88,6 +93,9 @@ static uint32_t adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 	uint8_t ack;
 	platform_timeout timeout;
 
+	if (dp->sticky_error)
+		return 0;
+
 	request = ((uint64_t)value << 3) | ((addr >> 1) & 0x06) | (RnW?1:0);
 
 	jtag_dev_write_ir(dp->dev, APnDP ? IR_APACC : IR_DPACC);
@@ -98,11 +106,15 @@ static uint32_t adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 		ack = response & 0x07;
 	} while(!platform_timeout_is_expired(&timeout) && (ack == JTAGDP_ACK_WAIT));
 
-	if (ack == JTAGDP_ACK_WAIT)
-		raise_exception(EXCEPTION_TIMEOUT, "JTAG-DP ACK timeout");
+	if (ack == JTAGDP_ACK_WAIT) {
+		adiv5_dp_raise(dp, EXCEPTION_TIMEOUT, "JTAG-DP ACK timeout");
+		return 0;
+	}
 
-	if((ack != JTAGDP_ACK_OK))
-		raise_exception(EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+	if((ack != JTAGDP_ACK_OK)) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+		return 0;
+	}
 
 	return (uint32_t)(response >> 3);
 }
@@ -113,3 +125,26 @@ static void adiv5_jtagdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 	jtag_dev_write_ir(dp->dev, IR_ABORT);
 	jtag_dev_shift_dr(dp->dev, NULL, (const uint8_t*)&request, 35);
 }
+
+/* A JTAG-DP scan captures the result of the previous one, so the DCRDR
+ * read for one register is collected by the DCRSR write selecting the
+ * next, without switching to DPACC for RDBUFF in between. */
+static bool adiv5_jtagdp_core_regs_read(ADIv5_AP_t *ap, const uint32_t *regsel,
+                                        uint32_t *regs, size_t n)
+{
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_jtagdp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+
+	adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regsel[0]); /* Required to switch banks */
+	adiv5_jtagdp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DB(DB_DCRDR), 0);
+	for (size_t i = 1; i < n; i++) {
+		regs[i - 1] = adiv5_jtagdp_low_access(ap->dp, ADIV5_LOW_WRITE,
+		                                      ADIV5_AP_DB(DB_DCRSR), regsel[i]);
+		adiv5_jtagdp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DB(DB_DCRDR), 0);
+	}
+	regs[n - 1] = adiv5_jtagdp_low_access(ap->dp, ADIV5_LOW_READ,
+	                                      ADIV5_DP_RDBUFF, 0);
+
+	uint32_t dhcsr = adiv5_jtagdp_read(ap->dp, ADIV5_AP_DB(DB_DHCSR));
+	return dhcsr & CORTEXM_DHCSR_S_REGRDY;
+}
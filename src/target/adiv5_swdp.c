@@ -28,6 +28,7 @@
 #include "swdptap.h"
 #include "target.h"
 #include "target_internal.h"
+#include "cortexm.h"
 
 #define SWDP_ACK_OK    0x01
 #define SWDP_ACK_WAIT  0x02
@@ -42,6 +43,9 @@ static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 
 static void adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort);
 
+static bool adiv5_swdp_core_regs_read(ADIv5_AP_t *ap, const uint32_t *regsel,
+                                      uint32_t *regs, size_t n);
+
 int adiv5_swdp_scan(void)
 {
 	uint32_t ack;
@@ -80,6 +84,7 @@ int adiv5_swdp_scan(void)
 	dp->error = adiv5_swdp_error;
 	dp->low_access = adiv5_swdp_low_access;
 	dp->abort = adiv5_swdp_abort;
+	dp->core_regs_read = adiv5_swdp_core_regs_read;
 
 	adiv5_swdp_error(dp);
 	adiv5_dp_init(dp);
@@ -132,6 +137,7 @@ static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 	platform_timeout timeout;
 
 	if(APnDP && dp->fault) return 0;
+	if(dp->sticky_error) return 0;
 
 	if(APnDP) request ^= 0x22;
 	if(RnW)   request ^= 0x24;
@@ -147,20 +153,26 @@ static uint32_t adiv5_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 		ack = swdptap_seq_in(3);
 	} while (ack == SWDP_ACK_WAIT && !platform_timeout_is_expired(&timeout));
 
-	if (ack == SWDP_ACK_WAIT)
-		raise_exception(EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+	if (ack == SWDP_ACK_WAIT) {
+		adiv5_dp_raise(dp, EXCEPTION_TIMEOUT, "SWDP ACK timeout");
+		return 0;
+	}
 
 	if(ack == SWDP_ACK_FAULT) {
 		dp->fault = 1;
 		return 0;
 	}
 
-	if(ack != SWDP_ACK_OK)
-		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	if(ack != SWDP_ACK_OK) {
+		adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP invalid ACK");
+		return 0;
+	}
 
 	if(RnW) {
-		if(swdptap_seq_in_parity(&response, 32))  /* Give up on parity error */
-			raise_exception(EXCEPTION_ERROR, "SWDP Parity error");
+		if(swdptap_seq_in_parity(&response, 32)) { /* Give up on parity error */
+			adiv5_dp_raise(dp, EXCEPTION_ERROR, "SWDP Parity error");
+			return 0;
+		}
 	} else {
 		swdptap_seq_out_parity(value, 32);
 		/* RM0377 Rev. 8 Chapter 27.5.4 for STM32L0x1 states:
@@ -183,3 +195,29 @@ static void adiv5_swdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	adiv5_dp_write(dp, ADIV5_DP_ABORT, abort);
 }
+
+/* AP reads on SW-DP are posted: each read returns the result of the one
+ * before it.  So the DCRDR value for one register arrives with the read
+ * for the next, and RDBUFF is only read once at the end. */
+static bool adiv5_swdp_core_regs_read(ADIv5_AP_t *ap, const uint32_t *regsel,
+                                      uint32_t *regs, size_t n)
+{
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_swdp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+
+	adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regsel[0]); /* Required to switch banks */
+	adiv5_swdp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DB(DB_DCRDR), 0);
+	for (size_t i = 1; i < n; i++) {
+		adiv5_swdp_low_access(ap->dp, ADIV5_LOW_WRITE,
+		                      ADIV5_AP_DB(DB_DCRSR), regsel[i]);
+		regs[i - 1] = adiv5_swdp_low_access(ap->dp, ADIV5_LOW_READ,
+		                                    ADIV5_AP_DB(DB_DCRDR), 0);
+	}
+	regs[n - 1] = adiv5_swdp_low_access(ap->dp, ADIV5_LOW_READ,
+	                                    ADIV5_DP_RDBUFF, 0);
+
+	/* Only the last transfer is checked, a core slow enough to miss
+	 * an earlier one would miss this one too. */
+	uint32_t dhcsr = adiv5_swdp_read(ap->dp, ADIV5_AP_DB(DB_DHCSR));
+	return !ap->dp->fault && (dhcsr & CORTEXM_DHCSR_S_REGRDY);
+}
@@ -24,6 +24,8 @@
  * ARM doc DDI0406C.
  *
  * Cache line length is from Cortex-A9 TRM, may differ for others.
+ * Memory is accessed through a system bus MEM-AP if the DP has one, so
+ * only address translation and cache maintenance go through the core.
  * Janky reset code is for Zynq-7000 which disconnects the DP from the JTAG
  * scan chain during reset.
  */
@@ -71,6 +73,9 @@ struct cortexa_priv {
 	uint32_t bcr0;
 	uint32_t bvr0;
 	bool mmu_fault;
+	/* System bus MEM-AP for physical memory access, may be NULL */
+	ADIv5_AP_t *ahb;
+	uint32_t sctlr;
 };
 
 /* This may be specific to Cortex-A9 */
@@ -124,6 +129,12 @@ struct cortexa_priv {
 #define DBGDTRRXint CPREG(14, 0, 0, 0, 5, 0)
 #define DBGDTRTXint CPREG(14, 0, 0, 0, 5, 0)
 
+/* System control register CP15 */
+#define SCTLR       CPREG(15, 0, 0, 1, 0, 0)
+#define SCTLR_I     (1 << 12)
+#define SCTLR_C     (1 << 2)
+#define SCTLR_M     (1 << 0)
+
 /* Address translation registers CP15 */
 #define PAR         CPREG(15, 0, 0, 7, 4, 0)
 #define ATS1CPR     CPREG(15, 0, 0, 7, 8, 0)
@@ -131,6 +142,7 @@ struct cortexa_priv {
 /* Cache management registers CP15 */
 #define ICIALLU     CPREG(15, 0, 0, 7, 5, 0)
 #define DCCIMVAC    CPREG(15, 0, 0, 7, 14, 1)
+#define DCIMVAC     CPREG(15, 0, 0, 7, 6, 1)
 #define DCCMVAC     CPREG(15, 0, 0, 7, 10, 1)
 
 /* Thumb mode bit in CPSR */
@@ -309,14 +321,126 @@ static void cortexa_slow_mem_write(target *t, target_addr dest, const void *src,
 	}
 }
 
+/* Clean and/or invalidate the data cache by VA, so the system bus sees
+ * the same memory as the core */
+static void cortexa_cache_op(target *t, uint32_t op, target_addr addr, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	target_addr end = addr + len;
+
+	for (addr &= ~(CACHE_LINE_LENGTH - 1); addr < end; addr += CACHE_LINE_LENGTH) {
+		write_gpreg(t, 0, addr);
+		apb_write(t, DBGITR, MCR | op);
+	}
+	if (apb_read(t, DBGDSCR) & DBGDSCR_SDABORT_L) {
+		apb_write(t, DBGDRCR, DBGDRCR_CSE);
+		priv->mmu_fault = true;
+	}
+}
+
+/* Translate page by page, the MEM-AP only sees physical addresses */
+static target_addr cortexa_phys(target *t, target_addr va, size_t *len)
+{
+	struct cortexa_priv *priv = t->priv;
+
+	*len = MIN(*len, 0x1000 - (va & 0xfff));
+	if (!(priv->sctlr & SCTLR_M))
+		return va;
+	return va_to_pa(t, va);
+}
+
+static void cortexa_mem_read(target *t, void *dest, target_addr src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+
+	if (priv->sctlr & SCTLR_C)
+		cortexa_cache_op(t, DCCMVAC, src, len);
+
+	while (len && !priv->mmu_fault) {
+		size_t chunk = len;
+		target_addr pa = cortexa_phys(t, src, &chunk);
+		if (priv->mmu_fault)
+			return;
+		adiv5_mem_read(priv->ahb, dest, pa, chunk);
+		dest = (uint8_t *)dest + chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+static void cortexa_mem_write(target *t, target_addr dest, const void *src, size_t len)
+{
+	struct cortexa_priv *priv = t->priv;
+	target_addr start = dest;
+	size_t total = len;
+
+	/* Write back dirty lines first, so they can't land on top of ours */
+	if (priv->sctlr & SCTLR_C)
+		cortexa_cache_op(t, DCCMVAC, start, total);
+
+	while (len && !priv->mmu_fault) {
+		size_t chunk = len;
+		target_addr pa = cortexa_phys(t, dest, &chunk);
+		if (priv->mmu_fault)
+			return;
+		adiv5_mem_write(priv->ahb, pa, src, chunk);
+		src = (const uint8_t *)src + chunk;
+		dest += chunk;
+		len -= chunk;
+	}
+
+	/* then drop the now stale, clean, lines without writing them back */
+	if (priv->sctlr & SCTLR_C)
+		cortexa_cache_op(t, DCIMVAC, start, total);
+	if (priv->sctlr & SCTLR_I)
+		apb_write(t, DBGITR, MCR | ICIALLU);
+}
+
 static bool cortexa_check_error(target *t)
 {
 	struct cortexa_priv *priv = t->priv;
 	bool err = priv->mmu_fault;
 	priv->mmu_fault = false;
+	if (priv->ahb && adiv5_dp_error(priv->ahb->dp))
+		err = true;
 	return err;
 }
 
+/* Look for a system bus MEM-AP (AHB or AXI) on the DP of the core */
+static ADIv5_AP_t *cortexa_find_sysap(ADIv5_DP_t *dp, uint8_t apb_sel)
+{
+	for (int i = 0; i < 256; i++) {
+		if ((i == apb_sel) || !adiv5_ap_setup(i))
+			continue;
+		ADIv5_AP_t *ap = adiv5_new_ap(dp, i);
+		if (!ap) {
+			adiv5_ap_cleanup(i);
+			break;
+		}
+		adiv5_ap_ref(ap);
+		/* IDR class 8 is a MEM-AP, types 1, 4, 5, 7 and 8 are AHB/AXI */
+		uint8_t type = ap->idr & 0xf;
+		if ((((ap->idr >> 13) & 0xf) == 8) &&
+		    ((type == 1) || (type == 4) || (type == 5) ||
+		     (type == 7) || (type == 8))) {
+			DEBUG("Cortex-A: using AP %d for memory access\n", i);
+			return ap;
+		}
+		adiv5_ap_unref(ap);
+		adiv5_ap_cleanup(i);
+	}
+	return NULL;
+}
+
+static void cortexa_priv_free(void *priv)
+{
+	struct cortexa_priv *p = priv;
+	if (p->ahb)
+		adiv5_ap_unref(p->ahb);
+	adiv5_ap_unref(p->apb);
+	free(priv);
+}
+
 
 bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 {
@@ -335,10 +459,16 @@ bool cortexa_probe(ADIv5_AP_t *apb, uint32_t debug_base)
 	}
 
 	t->priv = priv;
-	t->priv_free = free;
+	t->priv_free = cortexa_priv_free;
 	priv->apb = apb;
-	t->mem_read = cortexa_slow_mem_read;
-	t->mem_write = cortexa_slow_mem_write;
+	priv->ahb = cortexa_find_sysap(apb->dp, apb->apsel);
+	if (priv->ahb) {
+		t->mem_read = cortexa_mem_read;
+		t->mem_write = cortexa_mem_write;
+	} else {
+		t->mem_read = cortexa_slow_mem_read;
+		t->mem_write = cortexa_slow_mem_write;
+	}
 
 	priv->base = debug_base;
 	/* Set up APB CSW, we won't touch this again */
@@ -551,27 +681,24 @@ static void cortexa_reset(target *t)
 
 static void cortexa_halt_request(target *t)
 {
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		apb_write(t, DBGDRCR, DBGDRCR_HRQ);
-	}
-	if (e.type) {
+	struct cortexa_priv *priv = t->priv;
+	adiv5_dp_sticky_begin(priv->apb->dp, EXCEPTION_TIMEOUT);
+	apb_write(t, DBGDRCR, DBGDRCR_HRQ);
+	if (adiv5_dp_sticky_end(priv->apb->dp)) {
 		tc_printf(t, "Timeout sending interrupt, is target in WFI?\n");
 	}
 }
 
 static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch)
 {
+	struct cortexa_priv *priv = t->priv;
 	(void)watch; /* No watchpoint support yet */
 
-	volatile uint32_t dbgdscr = 0;
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_ALL) {
-		/* If this times out because the target is in WFI then
-		 * the target is still running. */
-		dbgdscr = apb_read(t, DBGDSCR);
-	}
-	switch (e.type) {
+	/* If this times out because the target is in WFI then
+	 * the target is still running. */
+	adiv5_dp_sticky_begin(priv->apb->dp, EXCEPTION_ALL);
+	uint32_t dbgdscr = apb_read(t, DBGDSCR);
+	switch (adiv5_dp_sticky_end(priv->apb->dp)) {
 	case EXCEPTION_ERROR:
 		/* Oh crap, there's no recovery from this... */
 		target_list_free();
@@ -600,6 +727,11 @@ static enum target_halt_reason cortexa_halt_poll(target *t, target_addr *watch)
 	}
 
 	cortexa_regs_read_internal(t);
+	/* MMU and cache state decide how memory is accessed while halted */
+	if (priv->ahb) {
+		apb_write(t, DBGITR, MRC | SCTLR);
+		priv->sctlr = read_gpreg(t, 0);
+	}
 
 	return reason;
 }
@@ -40,9 +40,15 @@ he terms of the GNU General Public License as published by
 static const char cortexm_driver_str[] = "ARM Cortex-M";
 
 static bool cortexm_vector_catch(target *t, int argc, char *argv[]);
+static bool cortexm_profile(target *t, int argc, char *argv[]);
 
 const struct command_s cortexm_cmd_list[] = {
 	{"vector_catch", (cmd_handler)cortexm_vector_catch, "Catch exception vectors"},
+#if defined(PC_HOSTED)
+	{"profile", (cmd_handler)cortexm_profile, "Sample the PC while running: [ms] [gmon.out file]"},
+#else
+	{"profile", (cmd_handler)cortexm_profile, "Sample the PC while running: [ms]"},
+#endif
 	{NULL, NULL, NULL}
 };
 
@@ -52,7 +58,10 @@ const struct command_s cortexm_cmd_list[] = {
 
 static void cortexm_regs_read(target *t, void *data);
 static void cortexm_regs_write(target *t, const void *data);
+static uint32_t cortexm_core_reg_read(target *t, uint32_t regsel);
+static ssize_t cortexm_reg_read(target *t, int reg, void *data, size_t max);
 static uint32_t cortexm_pc_read(target *t);
+static int cortexm_crc32(target *t, target_addr addr, size_t len, uint32_t *crc);
 
 static void cortexm_reset(target *t);
 static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch);
@@ -84,6 +93,11 @@ struct cortexm_priv {
 	/* Cache parameters */
 	bool has_cache;
 	uint32_t dcache_minline;
+	unsigned dcache_line_shift;
+	unsigned dcache_sets;
+	unsigned dcache_ways;
+	uint32_t itcm_size;
+	uint32_t dtcm_size;
 };
 
 /* Register number tables */
@@ -191,6 +205,72 @@ ADIv5_AP_t *cortexm_ap(target *t)
 	return ((struct cortexm_priv *)t->priv)->ap;
 }
 
+/* Cache maintenance operations are queued up and streamed to their fixed
+ * register address in one burst */
+#define CORTEXM_CACHE_BATCH	32
+
+/* Trim [*lo, *hi) so it doesn't start or end inside [base, base + size) */
+static void cache_skip_window(target_addr base, uint32_t size,
+                              target_addr *lo, target_addr *hi)
+{
+	if (!size)
+		return;
+	if ((*lo >= base) && (*lo - base < size))
+		*lo = MIN(base + size, *hi);
+	if ((*hi > base) && (*hi - base <= size))
+		*hi = MAX(base, *lo);
+}
+
+/* Intersect the requested region with a RAM region, leaving out memory
+ * that is known not to be cached.  *mpu caches MPU_CTRL.ENABLE, -1 when
+ * not read yet. */
+static bool cortexm_cache_range(target *t, struct target_ram *r,
+                                target_addr addr, size_t len,
+                                target_addr *lo, target_addr *hi, int *mpu)
+{
+	struct cortexm_priv *priv = t->priv;
+
+	*lo = MAX(addr, r->start);
+	*hi = MIN(addr + len, r->start + r->length); /* empty if wraparound */
+	cache_skip_window(CORTEXM_ITCM_BASE, priv->itcm_size, lo, hi);
+	cache_skip_window(CORTEXM_DTCM_BASE, priv->dtcm_size, lo, hi);
+	if (*lo >= *hi)
+		return false;
+
+	/* Device memory in the default memory map, unless the MPU remaps it */
+	if (((*lo >= 0x40000000) && (*hi <= 0x60000000)) ||
+	    ((*lo >= 0xA0000000) && (*hi <= 0xE0000000))) {
+		if (*mpu < 0)
+			*mpu = target_mem_read32(t, CORTEXM_MPU_CTRL) & 1;
+		return *mpu;
+	}
+	return true;
+}
+
+/* Clean (and invalidate) the whole data cache by set/way */
+static void cortexm_cache_clean_all(target *t, bool invalidate)
+{
+	struct cortexm_priv *priv = t->priv;
+	uint32_t cache_reg = invalidate ? CORTEXM_DCCISW : CORTEXM_DCCSW;
+	unsigned way_shift = (priv->dcache_ways > 1) ?
+	                     __builtin_clz(priv->dcache_ways - 1) : 0;
+	uint32_t ops[CORTEXM_CACHE_BATCH];
+	size_t n = 0;
+
+	for (unsigned way = 0; way < priv->dcache_ways; way++) {
+		for (unsigned set = 0; set < priv->dcache_sets; set++) {
+			ops[n++] = (way_shift ? (way << way_shift) : 0) |
+			           (set << priv->dcache_line_shift);
+			if (n == CORTEXM_CACHE_BATCH) {
+				adiv5_mem_write_repeat(cortexm_ap(t), cache_reg, ops, n);
+				n = 0;
+			}
+		}
+	}
+	if (n)
+		adiv5_mem_write_repeat(cortexm_ap(t), cache_reg, ops, n);
+}
+
 static void cortexm_cache_clean(target *t, target_addr addr, size_t len, bool invalidate)
 {
 	struct cortexm_priv *priv = t->priv;
@@ -198,22 +278,38 @@ static void cortexm_cache_clean(target *t, target_addr addr, size_t len, bool in
 		return;
 	uint32_t cache_reg = invalidate ? CORTEXM_DCCIMVAC : CORTEXM_DCCMVAC;
 	size_t minline = priv->dcache_minline;
+	target_addr lo, hi;
+	int mpu = -1;
+
+	/* Count the lines to maintain, past the size of the cache it is
+	 * cheaper to clean all of it by set/way */
+	size_t lines = 0;
+	for (struct target_ram *r = t->ram; r; r = r->next)
+		if (cortexm_cache_range(t, r, addr, len, &lo, &hi, &mpu))
+			lines += (hi - (lo & ~(minline - 1)) + minline - 1) / minline;
+	if (!lines)
+		return;
+	if (priv->dcache_sets &&
+	    (lines > priv->dcache_sets * priv->dcache_ways)) {
+		cortexm_cache_clean_all(t, invalidate);
+		return;
+	}
 
-	/* flush data cache for RAM regions that intersect requested region */
-	target_addr mem_end = addr + len; /* following code is NOP if wraparound */
-	/* requested region is [src, src_end) */
+	uint32_t ops[CORTEXM_CACHE_BATCH];
+	size_t n = 0;
 	for (struct target_ram *r = t->ram; r; r = r->next) {
-		target_addr ram = r->start;
-		target_addr ram_end = r->start + r->length;
-		/* RAM region is [ram, ram_end) */
-		if (addr > ram)
-			ram = addr;
-		if (mem_end < ram_end)
-			ram_end = mem_end;
-		/* intersection is [ram, ram_end) */
-		for (ram &= ~(minline-1); ram < ram_end; ram += minline)
-			adiv5_mem_write(cortexm_ap(t), cache_reg, &ram, 4);
+		if (!cortexm_cache_range(t, r, addr, len, &lo, &hi, &mpu))
+			continue;
+		for (lo &= ~(minline - 1); lo < hi; lo += minline) {
+			ops[n++] = lo;
+			if (n == CORTEXM_CACHE_BATCH) {
+				adiv5_mem_write_repeat(cortexm_ap(t), cache_reg, ops, n);
+				n = 0;
+			}
+		}
 	}
+	if (n)
+		adiv5_mem_write_repeat(cortexm_ap(t), cache_reg, ops, n);
 }
 
 static void cortexm_mem_read(target *t, void *dest, target_addr src, size_t len)
@@ -260,6 +356,87 @@ static bool cortexm_forced_halt(target *t)
 	return true;
 }
 
+typedef bool (*probe_func)(target *t);
+
+static const probe_func cortexm_probes[] = {
+	stm32f1_probe,
+	stm32f4_probe,
+	stm32h7_probe,
+	stm32l0_probe,   /* STM32L0xx & STM32L1xx */
+	stm32l4_probe,
+	lpc11xx_probe,
+	lpc15xx_probe,
+	lpc43xx_probe,
+	sam3x_probe,
+	sam4l_probe,
+	nrf51_probe,
+	samd_probe,
+	lmi_probe,
+	kinetis_probe,
+	efm32_probe,
+	msp432_probe,
+	ke04_probe,
+	lpc17xx_probe,
+	NULL
+};
+
+/* Drivers to try first, by ROM table designer */
+static const struct {
+	uint16_t designer;
+	probe_func probe[6];
+} cortexm_probe_table[] = {
+	{ADIV5_DESIGNER_STM, {stm32f1_probe, stm32f4_probe, stm32h7_probe,
+	                      stm32l0_probe, stm32l4_probe, NULL}},
+	{ADIV5_DESIGNER_NXP, {lpc11xx_probe, lpc15xx_probe, lpc43xx_probe,
+	                      lpc17xx_probe, NULL}},
+	{ADIV5_DESIGNER_ATMEL, {sam3x_probe, sam4l_probe, samd_probe, NULL}},
+	{ADIV5_DESIGNER_NORDIC, {nrf51_probe, NULL}},
+	{ADIV5_DESIGNER_TEXAS, {lmi_probe, msp432_probe, NULL}},
+	{ADIV5_DESIGNER_FREESCALE, {kinetis_probe, ke04_probe, NULL}},
+	{ADIV5_DESIGNER_ENERGY_MICRO, {efm32_probe, NULL}},
+};
+
+/* Read the designer of the AP's ROM table.  PIDR4 to PIDR3 are
+ * fetched in a single transfer. */
+static const probe_func *cortexm_probe_candidates(ADIv5_AP_t *ap)
+{
+	uint32_t pidr[8];
+
+	if ((ap->base == 0xffffffff) || !(ap->base & ADIV5_AP_BASE_PRESENT))
+		return NULL;
+	adiv5_mem_read(ap, pidr, (ap->base & ADIV5_AP_BASE_BASEADDR) + 0xfd0,
+	               sizeof(pidr));
+	if (adiv5_dp_error(ap->dp) || !(pidr[6] & 0x08)) /* PIDR2.JEDEC */
+		return NULL;
+
+	uint16_t designer = ((pidr[0] & 0xf) << 8) |
+	                    ((pidr[6] & 0x7) << 4) | ((pidr[5] >> 4) & 0xf);
+	DEBUG("ROM table designer 0x%03x\n", designer);
+	for (size_t i = 0;
+	     i < sizeof(cortexm_probe_table) / sizeof(cortexm_probe_table[0]); i++)
+		if (cortexm_probe_table[i].designer == designer)
+			return cortexm_probe_table[i].probe;
+	return NULL;
+}
+
+static bool cortexm_probe_listed(const probe_func *list, probe_func probe)
+{
+	for (; list && *list; list++)
+		if (*list == probe)
+			return true;
+	return false;
+}
+
+static bool cortexm_probe_driver(target *t, probe_func probe)
+{
+	if (probe(t)) {
+		target_halt_resume(t, 0);
+		return true;
+	}
+	target_check_error(t);
+	return false;
+}
+
 bool cortexm_probe(ADIv5_AP_t *ap, bool forced)
 {
 	target *t;
@@ -284,6 +461,7 @@ bool cortexm_probe(ADIv5_AP_t *ap, bool forced)
 	t->check_error = cortexm_check_error;
 	t->mem_read = cortexm_mem_read;
 	t->mem_write = cortexm_mem_write;
+	t->crc32 = cortexm_crc32;
 
 	t->driver = cortexm_driver_str;
 	switch (identity) {
@@ -308,6 +486,7 @@ bool cortexm_probe(ADIv5_AP_t *ap, bool forced)
 	t->tdesc = tdesc_cortex_m;
 	t->regs_read = cortexm_regs_read;
 	t->regs_write = cortexm_regs_write;
+	t->reg_read = cortexm_reg_read;
 
 	t->reset = cortexm_reset;
 	t->halt_request = cortexm_halt_request;
@@ -338,7 +517,24 @@ bool cortexm_probe(ADIv5_AP_t *ap, bool forced)
 	uint32_t ctr = target_mem_read32(t, CORTEXM_CTR);
 	if ((ctr >> 29) == 4) {
 		priv->has_cache = true;
-		priv->dcache_minline = 4 << (ctr & 0xf);
+		priv->dcache_minline = 4 << ((ctr >> 16) & 0xf);
+		/* L1 data cache geometry for set/way operations */
+		uint32_t csselr = target_mem_read32(t, CORTEXM_CSSELR);
+		target_mem_write32(t, CORTEXM_CSSELR, 0);
+		uint32_t ccsidr = target_mem_read32(t, CORTEXM_CCSIDR);
+		target_mem_write32(t, CORTEXM_CSSELR, csselr);
+		priv->dcache_line_shift = (ccsidr & 7) + 4;
+		priv->dcache_ways = ((ccsidr >> 3) & 0x3ff) + 1;
+		priv->dcache_sets = ((ccsidr >> 13) & 0x7fff) + 1;
+		/* TCMCR.SZ encodes 4KB as 3 */
+		uint32_t tcmcr = target_mem_read32(t, CORTEXM_ITCMCR);
+		if ((tcmcr & 1) && ((tcmcr >> 3) & 0xf) >= 3)
+			priv->itcm_size = 1 << (((tcmcr >> 3) & 0xf) + 9);
+		tcmcr = target_mem_read32(t, CORTEXM_DTCMCR);
+		if ((tcmcr & 1) && ((tcmcr >> 3) & 0xf) >= 3)
+			priv->dtcm_size = 1 << (((tcmcr >> 3) & 0xf) + 9);
+		if (target_check_error(t))
+			priv->dcache_sets = priv->itcm_size = priv->dtcm_size = 0;
 	} else {
 		target_check_error(t);
 	}
@@ -351,28 +547,18 @@ bool cortexm_probe(ADIv5_AP_t *ap, bool forced)
 		if (!cortexm_forced_halt(t))
 			return false;
 
-#define PROBE(x) \
-	do { if ((x)(t)) {target_halt_resume(t, 0); return true;} else target_check_error(t); } while (0)
-
-	PROBE(stm32f1_probe);
-	PROBE(stm32f4_probe);
-	PROBE(stm32h7_probe);
-	PROBE(stm32l0_probe);   /* STM32L0xx & STM32L1xx */
-	PROBE(stm32l4_probe);
-	PROBE(lpc11xx_probe);
-	PROBE(lpc15xx_probe);
-	PROBE(lpc43xx_probe);
-	PROBE(sam3x_probe);
-	PROBE(sam4l_probe);
-	PROBE(nrf51_probe);
-	PROBE(samd_probe);
-	PROBE(lmi_probe);
-	PROBE(kinetis_probe);
-	PROBE(efm32_probe);
-	PROBE(msp432_probe);
-	PROBE(ke04_probe);
-	PROBE(lpc17xx_probe);
-#undef PROBE
+	/* Try the drivers for the vendor named in the ROM table first, and
+	 * only fall back to the whole list if none of them match. */
+	const probe_func *candidates = cortexm_probe_candidates(ap);
+	if (candidates)
+		for (const probe_func *p = candidates; *p; p++)
+			if (cortexm_probe_driver(t, *p))
+				return true;
+
+	for (const probe_func *p = cortexm_probes; *p; p++)
+		if (!cortexm_probe_listed(candidates, *p) &&
+		    cortexm_probe_driver(t, *p))
+			return true;
 
 	return true;
 }
@@ -445,66 +631,50 @@ void cortexm_detach(target *t)
 	target_mem_read32(t, 0);
 }
 
-enum { DB_DHCSR, DB_DCRSR, DB_DCRDR, DB_DEMCR };
+/* Build the DCRSR REGSEL list matching the 'g' packet layout */
+static size_t cortexm_regsel(target *t, uint32_t *regsel)
+{
+	size_t n = sizeof(regnum_cortex_m) / 4;
+	memcpy(regsel, regnum_cortex_m, sizeof(regnum_cortex_m));
+	if (t->target_options & TOPT_FLAVOUR_V7MF) {
+		memcpy(regsel + n, regnum_cortex_mf, sizeof(regnum_cortex_mf));
+		n += sizeof(regnum_cortex_mf) / 4;
+	}
+	return n;
+}
 
 static void cortexm_regs_read(target *t, void *data)
 {
 	uint32_t *regs = data;
 	ADIv5_AP_t *ap = cortexm_ap(t);
-#if defined(STLINKV2)
-	extern void stlink_regs_read(ADIv5_AP_t *ap, void *data);
-	extern uint32_t stlink_reg_read(ADIv5_AP_t *ap, int idx);
-	stlink_regs_read(ap, data);
-	regs += sizeof(regnum_cortex_m);
-	if (t->target_options & TOPT_FLAVOUR_V7MF)
-		for(size_t t = 0; t < sizeof(regnum_cortex_mf) / 4; t++)
-			*regs++ = stlink_reg_read(ap, regnum_cortex_mf[t]);
-#else
-	unsigned i;
-
-	/* FIXME: Describe what's really going on here */
-	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	uint32_t regsel[(sizeof(regnum_cortex_m) + sizeof(regnum_cortex_mf)) / 4];
+	size_t n = cortexm_regsel(t, regsel);
 
-	/* Map the banked data registers (0x10-0x1c) to the
-	 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+	if (ap->dp->core_regs_read && ap->dp->core_regs_read(ap, regsel, regs, n))
+		return;
 
-	/* Walk the regnum_cortex_m array, reading the registers it
-	 * calls out. */
-	adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[0]); /* Required to switch banks */
-	*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-	for(i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR),
-		                    regnum_cortex_m[i]);
-		*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+	/* One register at a time, waiting for each transfer to complete */
+	for (size_t i = 0; i < n; i++) {
+		target_mem_write32(t, CORTEXM_DCRSR, regsel[i]);
+		platform_timeout timeout;
+		platform_timeout_set(&timeout, 20);
+		while (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_REGRDY) &&
+		       !platform_timeout_is_expired(&timeout));
+		regs[i] = target_mem_read32(t, CORTEXM_DCRDR);
 	}
-	if (t->target_options & TOPT_FLAVOUR_V7MF)
-		for(i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE,
-			                    ADIV5_AP_DB(DB_DCRSR),
-			                    regnum_cortex_mf[i]);
-			*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-		}
-#endif
 }
 
 static void cortexm_regs_write(target *t, const void *data)
 {
 	const uint32_t *regs = data;
 	ADIv5_AP_t *ap = cortexm_ap(t);
-#if defined(STLINKV2)
-	extern void stlink_reg_write(ADIv5_AP_t *ap, int num, uint32_t val);
-	for(size_t z = 1; z < sizeof(regnum_cortex_m) / 4; z++) {
-		stlink_reg_write(ap, regnum_cortex_m[z], *regs);
-		regs++;
-	if (t->target_options & TOPT_FLAVOUR_V7MF)
-		for(size_t z = 0; z < sizeof(regnum_cortex_mf) / 4; z++) {
-			stlink_reg_write(ap, regnum_cortex_mf[z], *regs);
-			regs++;
-		}
+	uint32_t regsel[(sizeof(regnum_cortex_m) + sizeof(regnum_cortex_mf)) / 4];
+	size_t n = cortexm_regsel(t, regsel);
+
+	if (ap->dp->core_regs_write) {
+		ap->dp->core_regs_write(ap, regsel, regs, n);
+		return;
 	}
-#else
-	unsigned i;
 
 	/* FIXME: Describe what's really going on here */
 	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
@@ -513,26 +683,17 @@ static void cortexm_regs_write(target *t, const void *data)
 	 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
 
-	/* Walk the regnum_cortex_m array, writing the registers it
+	/* Walk the register selector list, writing the registers it
 	 * calls out. */
-	adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRDR), *regs++); /* Required to switch banks */
+	adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRDR), regs[0]); /* Required to switch banks */
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR),
-	                    0x10000 | regnum_cortex_m[0]);
-	for(i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
+	                    CORTEXM_DCRSR_REGWnR | regsel[0]);
+	for (size_t i = 1; i < n; i++) {
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE,
-		                    ADIV5_AP_DB(DB_DCRDR), *regs++);
+		                    ADIV5_AP_DB(DB_DCRDR), regs[i]);
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR),
-		                    0x10000 | regnum_cortex_m[i]);
+		                    CORTEXM_DCRSR_REGWnR | regsel[i]);
 	}
-	if (t->target_options & TOPT_FLAVOUR_V7MF)
-		for(i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE,
-			                    ADIV5_AP_DB(DB_DCRDR), *regs++);
-			adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE,
-			                    ADIV5_AP_DB(DB_DCRSR),
-			                    0x10000 | regnum_cortex_mf[i]);
-		}
-#endif
 }
 
 int cortexm_mem_write_sized(
@@ -543,12 +704,52 @@ int cortexm_mem_write_sized(
 	return target_check_error(t);
 }
 
-static uint32_t cortexm_pc_read(target *t)
+static uint32_t cortexm_core_reg_read(target *t, uint32_t regsel)
 {
-	target_mem_write32(t, CORTEXM_DCRSR, 0x0F);
+	target_mem_write32(t, CORTEXM_DCRSR, regsel);
 	return target_mem_read32(t, CORTEXM_DCRDR);
 }
 
+/* Read one register numbered as in the 'g' packet, so expressions
+ * evaluated by the probe don't need the whole register set. */
+static ssize_t cortexm_reg_read(target *t, int reg, void *data, size_t max)
+{
+	const int nfp = sizeof(regnum_cortex_mf) / 4;
+	uint32_t val[2];
+	size_t len = 4;
+
+	if ((reg < 0) || (max < 4))
+		return -1;
+	if (reg < REG_SPECIAL) {
+		val[0] = cortexm_core_reg_read(t, regnum_cortex_m[reg]);
+	} else if (reg < REG_SPECIAL + 4) {
+		/* primask, basepri, faultmask and control share a word */
+		val[0] = cortexm_core_reg_read(t, regnum_cortex_m[REG_SPECIAL]);
+		val[0] = (val[0] >> (8 * (reg - REG_SPECIAL))) & 0xff;
+	} else if (!(t->target_options & TOPT_FLAVOUR_V7MF)) {
+		return -1;
+	} else if (reg == REG_SPECIAL + 4) {
+		val[0] = cortexm_core_reg_read(t, regnum_cortex_mf[0]);
+	} else if ((reg - REG_SPECIAL - 5) * 2 + 2 < nfp) {
+		/* d0-d15 are pairs of single precision registers */
+		int s = (reg - REG_SPECIAL - 5) * 2 + 1;
+		if (max < 8)
+			return -1;
+		val[0] = cortexm_core_reg_read(t, regnum_cortex_mf[s]);
+		val[1] = cortexm_core_reg_read(t, regnum_cortex_mf[s + 1]);
+		len = 8;
+	} else {
+		return -1;
+	}
+	memcpy(data, val, len);
+	return len;
+}
+
+static uint32_t cortexm_pc_read(target *t)
+{
+	return cortexm_core_reg_read(t, REG_PC);
+}
+
 static void cortexm_pc_write(target *t, const uint32_t val)
 {
 	target_mem_write32(t, CORTEXM_DCRDR, val);
@@ -593,40 +794,71 @@ static void cortexm_reset(target *t)
 
 static void cortexm_halt_request(target *t)
 {
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
-		target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY |
-		                                          CORTEXM_DHCSR_C_HALT |
-		                                          CORTEXM_DHCSR_C_DEBUGEN);
-	}
-	if (e.type) {
+	ADIv5_DP_t *dp = cortexm_ap(t)->dp;
+	adiv5_dp_sticky_begin(dp, EXCEPTION_TIMEOUT);
+	target_mem_write32(t, CORTEXM_DHCSR, CORTEXM_DHCSR_DBGKEY |
+	                                     CORTEXM_DHCSR_C_HALT |
+	                                     CORTEXM_DHCSR_C_DEBUGEN);
+	if (adiv5_dp_sticky_end(dp)) {
 		tc_printf(t, "Timeout sending interrupt, is target in WFI?\n");
 	}
 }
 
-static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
+/* Resume from a breakpoint whose condition didn't hold.  The FPB would
+ * match again on the same instruction, so step over it with the
+ * comparators for this address disabled first. */
+static void cortexm_break_resume(target *t, target_addr pc)
 {
 	struct cortexm_priv *priv = t->priv;
+	uint32_t comp[CORTEXM_MAX_BREAKPOINTS];
+	struct breakwatch *bw;
 
-	volatile uint32_t dhcsr = 0;
-	volatile struct exception e;
-	TRY_CATCH (e, EXCEPTION_ALL) {
-		/* If this times out because the target is in WFI then
-		 * the target is still running. */
-		dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
+	for (bw = t->bw_list; bw; bw = bw->next) {
+		if ((bw->type != TARGET_BREAK_HARD) || (bw->addr != pc))
+			continue;
+		comp[bw->reserved[0]] = target_mem_read32(t, CORTEXM_FPB_COMP(bw->reserved[0]));
+		target_mem_write32(t, CORTEXM_FPB_COMP(bw->reserved[0]), 0);
 	}
-	switch (e.type) {
+
+	cortexm_halt_resume(t, true);
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, 200);
+	while (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT) &&
+	       !platform_timeout_is_expired(&timeout));
+	target_mem_write32(t, CORTEXM_DFSR, CORTEXM_DFSR_RESETALL);
+	priv->on_bkpt = false;
+
+	for (bw = t->bw_list; bw; bw = bw->next)
+		if ((bw->type == TARGET_BREAK_HARD) && (bw->addr == pc))
+			target_mem_write32(t, CORTEXM_FPB_COMP(bw->reserved[0]),
+			                   comp[bw->reserved[0]]);
+
+	cortexm_halt_resume(t, false);
+}
+
+static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
+{
+	struct cortexm_priv *priv = t->priv;
+
+	/* If this times out because the target is in WFI then
+	 * the target is still running. */
+	adiv5_dp_sticky_begin(priv->ap->dp, EXCEPTION_ALL);
+	uint32_t dhcsr = target_mem_read32(t, CORTEXM_DHCSR);
+	switch (adiv5_dp_sticky_end(priv->ap->dp)) {
 	case EXCEPTION_ERROR:
 		/* Oh crap, there's no recovery from this... */
 		target_list_free();
 		return TARGET_HALT_ERROR;
 	case EXCEPTION_TIMEOUT:
 		/* Timeout isn't a problem, target could be in WFI */
+		t->sleeping = true;
 		return TARGET_HALT_RUNNING;
 	}
 
+	t->sleeping = !!(dhcsr & CORTEXM_DHCSR_S_SLEEP);
 	if (!(dhcsr & CORTEXM_DHCSR_S_HALT))
 		return TARGET_HALT_RUNNING;
+	t->sleeping = false;
 
 	/* We've halted.  Let's find out why. */
 	uint32_t dfsr = target_mem_read32(t, CORTEXM_DFSR);
@@ -651,6 +883,13 @@ static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
 				return 0;
 			}
 		}
+		/* Breakpoint conditions and ignore counts are handled here
+		 * so GDB only hears about the hits it asked for. */
+		if (!priv->stepping && !(dfsr & CORTEXM_DFSR_DWTTRAP) &&
+		    !target_breakwatch_check(t, pc)) {
+			cortexm_break_resume(t, pc);
+			return TARGET_HALT_RUNNING;
+		}
 	}
 
 	if (dfsr & CORTEXM_DFSR_DWTTRAP) {
@@ -752,8 +991,10 @@ static int cortexm_fault_unwind(target *t)
 	return 0;
 }
 
-int cortexm_run_stub(target *t, uint32_t loadaddr,
-                     uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+/* Start a stub without waiting for it, for stubs that keep running
+ * while the debugger talks to them through target memory. */
+int cortexm_start_stub(target *t, uint32_t loadaddr,
+                       uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
 {
 	uint32_t regs[t->regs_size / 4];
 
@@ -764,17 +1005,22 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 	regs[3] = r3;
 	regs[15] = loadaddr;
 	regs[16] = 0x1000000;
-	regs[19] = 0;
+	regs[19] = 1; /* PRIMASK: keep the target's own IRQ handlers out */
 
 	cortexm_regs_write(t, regs);
 
 	if (target_check_error(t))
 		return -1;
 
-	/* Execute the stub */
+	target_halt_resume(t, false);
+	return 0;
+}
+
+/* Wait for a running stub to exit, returns its bkpt immediate */
+int cortexm_wait_stub(target *t)
+{
 	enum target_halt_reason reason;
-	cortexm_halt_resume(t, 0);
-	while ((reason = cortexm_halt_poll(t, NULL)) == TARGET_HALT_RUNNING)
+	while ((reason = target_halt_poll(t, NULL)) == TARGET_HALT_RUNNING)
 		;
 
 	if (reason == TARGET_HALT_ERROR)
@@ -791,6 +1037,88 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 	return bkpt_instr & 0xff;
 }
 
+int cortexm_run_stub(target *t, uint32_t loadaddr,
+                     uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	if (cortexm_start_stub(t, loadaddr, r0, r1, r2, r3))
+		return -1;
+
+	/* Execute the stub */
+	return cortexm_wait_stub(t);
+}
+
+/* Find a RAM region to load a stub into.  Prefer the SRAM region of the
+ * ARMv7-M memory map, as other RAMs (e.g. STM32F4 CCM) may not be
+ * executable. */
+struct target_ram *cortexm_stub_ram(target *t, size_t len)
+{
+	struct target_ram *ram = NULL;
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		if ((r->length < len) || (r->start >= CORTEXM_PERIPH_BASE))
+			continue;
+		if ((r->start <= CORTEXM_SRAM_BASE) &&
+		    (CORTEXM_SRAM_BASE - r->start < r->length)) {
+			ram = r;
+			break;
+		}
+		if (!ram)
+			ram = r;
+	}
+	return ram;
+}
+
+static const uint16_t cortexm_crc32_stub[] = {
+#include "flashstub/crc32.stub"
+};
+
+/* Below this length saving and restoring the core state costs more link
+ * traffic than reading the range back */
+#define CORTEXM_CRC32_STUB_MIN	0x400
+
+/* Checksum a range on the target itself, only the result crosses the link.
+ * Registers and the RAM used for the stub are restored afterwards, so
+ * this is safe to use in the middle of a debug session. */
+static int cortexm_crc32(target *t, target_addr addr, size_t len, uint32_t *crc)
+{
+	struct cortexm_priv *priv = t->priv;
+	struct target_ram *ram;
+
+	if (len < CORTEXM_CRC32_STUB_MIN)
+		return -1;
+	/* A flash loader or ROM call still running from another flash owns
+	 * the core and the stub RAM, leave it alone */
+	if (!(target_mem_read32(t, CORTEXM_DHCSR) & CORTEXM_DHCSR_S_HALT))
+		return -1;
+	if (!(ram = cortexm_stub_ram(t, sizeof(cortexm_crc32_stub))))
+		return -1;
+	target_addr stub = ram->start;
+	/* The stub can't checksum the RAM it is running from */
+	if ((addr < stub + sizeof(cortexm_crc32_stub)) && (stub < addr + len))
+		return -1;
+
+	uint32_t regs[t->regs_size / 4];
+	uint8_t ram_save[sizeof(cortexm_crc32_stub)];
+	bool on_bkpt = priv->on_bkpt;
+
+	target_regs_read(t, regs);
+	target_mem_read(t, ram_save, stub, sizeof(ram_save));
+	target_mem_write(t, stub, cortexm_crc32_stub, sizeof(cortexm_crc32_stub));
+	if (target_check_error(t))
+		return -1;
+
+	int ret = cortexm_run_stub(t, stub, addr, len, 0xffffffff, 0);
+	if (ret == 0)
+		*crc = cortexm_core_reg_read(t, 0);
+
+	target_mem_write(t, stub, ram_save, sizeof(ram_save));
+	target_regs_write(t, regs);
+	priv->on_bkpt = on_bkpt;
+
+	if (target_check_error(t))
+		return -1;
+	return ret;
+}
+
 /* The following routines implement hardware breakpoints and watchpoints.
  * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
  * systems are used. */
@@ -956,6 +1284,191 @@ static bool cortexm_vector_catch(target *t, int argc, char *argv[])
 	return true;
 }
 
+/* Statistical profiler.  DWT_PCSR can be read through the MEM-AP while the
+ * core runs, so bursts of non-incrementing reads give a PC histogram
+ * without halting the target or needing SWO. */
+#if defined(PC_HOSTED)
+#define PROFILE_SLOTS	0x10000
+#else
+#define PROFILE_SLOTS	0x100
+#endif
+#define PROFILE_PROBES	8
+#define PROFILE_BURST	32
+#define PROFILE_TOP	16
+#define PROFILE_GMON_BINS	0x100000
+
+/* PCSR value when the core is halted or sleeping */
+#define PROFILE_PC_IDLE	0xffffffff
+
+struct profile {
+	struct profile_slot {
+		uint32_t pc;
+		uint32_t count;
+	} *slot;
+	uint32_t samples;
+	uint32_t idle;
+	uint32_t dropped;
+};
+
+static void profile_add(struct profile *p, uint32_t pc)
+{
+	p->samples++;
+	if (pc == PROFILE_PC_IDLE) {
+		p->idle++;
+		return;
+	}
+
+	unsigned h = ((pc >> 1) * 2654435761u) & (PROFILE_SLOTS - 1);
+	for (int i = 0; i < PROFILE_PROBES; i++) {
+		struct profile_slot *s = &p->slot[h];
+		if (!s->count || (s->pc == pc)) {
+			s->pc = pc;
+			s->count++;
+			return;
+		}
+		h = (h + 1) & (PROFILE_SLOTS - 1);
+	}
+	p->dropped++;
+}
+
+#if defined(PC_HOSTED)
+static void gmon_put32(FILE *f, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		fputc(v >> (8 * i), f);
+}
+
+/* Write the histogram as a gprof gmon.out file.  Bins start at one
+ * halfword and are widened until the sampled range fits. */
+static bool profile_write_gmon(struct profile *p, const char *name,
+                               uint32_t rate)
+{
+	uint32_t low = ~0, high = 0;
+	for (int i = 0; i < PROFILE_SLOTS; i++) {
+		if (!p->slot[i].count)
+			continue;
+		low = MIN(low, p->slot[i].pc);
+		high = MAX(high, p->slot[i].pc);
+	}
+	if (low > high)
+		return false;
+
+	uint32_t scale = 2;
+	while ((high - low) / scale >= PROFILE_GMON_BINS)
+		scale <<= 1;
+	low &= ~(scale - 1);
+	uint32_t nbins = (high - low) / scale + 1;
+
+	uint16_t *hist = calloc(nbins, sizeof(*hist));
+	if (!hist)
+		return false;
+	for (int i = 0; i < PROFILE_SLOTS; i++) {
+		struct profile_slot *s = &p->slot[i];
+		if (!s->count)
+			continue;
+		uint32_t n = hist[(s->pc - low) / scale] + s->count;
+		hist[(s->pc - low) / scale] = MIN(n, 0xffff);
+	}
+
+	FILE *f = fopen(name, "wb");
+	if (!f) {
+		free(hist);
+		return false;
+	}
+	/* struct gmon_hdr: cookie, version, spare */
+	fwrite("gmon", 1, 4, f);
+	gmon_put32(f, 1);
+	for (int i = 0; i < 3; i++)
+		gmon_put32(f, 0);
+	/* GMON_TAG_TIME_HIST record */
+	fputc(0, f);
+	gmon_put32(f, low);
+	gmon_put32(f, low + nbins * scale);
+	gmon_put32(f, nbins);
+	gmon_put32(f, rate);
+	fwrite("seconds\0\0\0\0\0\0\0\0", 1, 15, f);
+	fputc('s', f);
+	for (uint32_t i = 0; i < nbins; i++) {
+		fputc(hist[i], f);
+		fputc(hist[i] >> 8, f);
+	}
+	free(hist);
+	return fclose(f) == 0;
+}
+#endif
+
+static bool cortexm_profile(target *t, int argc, char *argv[])
+{
+	uint32_t ms = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000;
+#if !defined(PC_HOSTED)
+	if (argc > 2) {
+		tc_printf(t, "gmon.out output needs a hosted probe\n");
+		return false;
+	}
+#endif
+
+	struct profile p = {0};
+	p.slot = calloc(PROFILE_SLOTS, sizeof(*p.slot));
+	if (!p.slot) {			/* calloc failed: heap exhaustion */
+		DEBUG("calloc: failed in %s\n", __func__);
+		return false;
+	}
+
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	uint32_t pcs[PROFILE_BURST];
+	platform_timeout timeout;
+
+	target_halt_resume(t, false);
+	uint32_t start = platform_time_ms();
+	platform_timeout_set(&timeout, ms);
+	while (!platform_timeout_is_expired(&timeout)) {
+		adiv5_mem_read_repeat(ap, pcs, CORTEXM_DWT_PCSR, PROFILE_BURST);
+		for (int i = 0; i < PROFILE_BURST; i++)
+			profile_add(&p, pcs[i]);
+	}
+	uint32_t elapsed = platform_time_ms() - start;
+	target_halt_request(t);
+	while (target_halt_poll(t, NULL) == TARGET_HALT_RUNNING)
+		;
+
+	uint32_t rate = elapsed ? (uint64_t)p.samples * 1000 / elapsed : 0;
+	uint32_t active = p.samples - p.idle;
+	tc_printf(t, "%"PRIu32" samples in %"PRIu32" ms (%"PRIu32" Hz), "
+	          "%"PRIu32" halted or sleeping, %"PRIu32" dropped\n",
+	          p.samples, elapsed, rate, p.idle, p.dropped);
+	if (!active)
+		tc_printf(t, "No PC samples, DWT_PCSR may not be implemented\n");
+
+#if defined(PC_HOSTED)
+	if ((argc > 2) && active) {
+		if (profile_write_gmon(&p, argv[2], rate))
+			tc_printf(t, "Histogram written to %s\n", argv[2]);
+		else
+			tc_printf(t, "Failed to write %s\n", argv[2]);
+	}
+#endif
+
+	/* Print the hottest PCs, clearing each once shown */
+	for (int n = 0; n < PROFILE_TOP; n++) {
+		struct profile_slot *best = NULL;
+		for (int i = 0; i < PROFILE_SLOTS; i++) {
+			if (p.slot[i].count &&
+			    (!best || (p.slot[i].count > best->count)))
+				best = &p.slot[i];
+		}
+		if (!best)
+			break;
+		uint32_t permille = (uint64_t)best->count * 1000 / active;
+		tc_printf(t, "0x%08"PRIx32" %8"PRIu32" %3"PRIu32".%"PRIu32"%%\n",
+		          best->pc, best->count, permille / 10, permille % 10);
+		best->count = 0;
+	}
+	tc_printf(t, "Target halted, use 'flushregs' to refresh GDB\n");
+
+	free(p.slot);
+	return true;
+}
+
 /* Windows defines this with some other meaning... */
 #ifdef SYS_OPEN
 #	undef SYS_OPEN
@@ -23,16 +23,25 @@
 #include "adiv5.h"
 
 extern long cortexm_wait_timeout;
+/* ARMv7-M default memory map regions */
+#define CORTEXM_SRAM_BASE	0x20000000
+#define CORTEXM_PERIPH_BASE	0x40000000
+
 /* Private peripheral bus base address */
 #define CORTEXM_PPB_BASE	0xE0000000
 
 #define CORTEXM_SCS_BASE	(CORTEXM_PPB_BASE + 0xE000)
 
+#define CORTEXM_SYST_CSR	(CORTEXM_SCS_BASE + 0x010)
+#define CORTEXM_SYST_RVR	(CORTEXM_SCS_BASE + 0x014)
+#define CORTEXM_SYST_CVR	(CORTEXM_SCS_BASE + 0x018)
+
 #define CORTEXM_AIRCR		(CORTEXM_SCS_BASE + 0xD0C)
 #define CORTEXM_CFSR		(CORTEXM_SCS_BASE + 0xD28)
 #define CORTEXM_HFSR		(CORTEXM_SCS_BASE + 0xD2C)
 #define CORTEXM_DFSR		(CORTEXM_SCS_BASE + 0xD30)
 #define CORTEXM_CPACR		(CORTEXM_SCS_BASE + 0xD88)
+#define CORTEXM_MPU_CTRL	(CORTEXM_SCS_BASE + 0xD94)
 #define CORTEXM_DHCSR		(CORTEXM_SCS_BASE + 0xDF0)
 #define CORTEXM_DCRSR		(CORTEXM_SCS_BASE + 0xDF4)
 #define CORTEXM_DCRDR		(CORTEXM_SCS_BASE + 0xDF8)
@@ -47,7 +56,15 @@ extern long cortexm_wait_timeout;
 /* Cache maintenance operations */
 #define CORTEXM_ICIALLU		(CORTEXM_SCS_BASE + 0xF50)
 #define CORTEXM_DCCMVAC		(CORTEXM_SCS_BASE + 0xF68)
+#define CORTEXM_DCCSW		(CORTEXM_SCS_BASE + 0xF6C)
 #define CORTEXM_DCCIMVAC	(CORTEXM_SCS_BASE + 0xF70)
+#define CORTEXM_DCCISW		(CORTEXM_SCS_BASE + 0xF74)
+
+/* Cortex-M7 TCM control, the TCMs are never cached */
+#define CORTEXM_ITCMCR		(CORTEXM_SCS_BASE + 0xF90)
+#define CORTEXM_DTCMCR		(CORTEXM_SCS_BASE + 0xF94)
+#define CORTEXM_ITCM_BASE	0x00000000
+#define CORTEXM_DTCM_BASE	0x20000000
 
 #define CORTEXM_FPB_BASE	(CORTEXM_PPB_BASE + 0x2000)
 
@@ -59,10 +76,17 @@ extern long cortexm_wait_timeout;
 #define CORTEXM_DWT_BASE	(CORTEXM_PPB_BASE + 0x1000)
 
 #define CORTEXM_DWT_CTRL	(CORTEXM_DWT_BASE + 0x000)
+#define CORTEXM_DWT_PCSR	(CORTEXM_DWT_BASE + 0x01C)
 #define CORTEXM_DWT_COMP(i)	(CORTEXM_DWT_BASE + 0x020 + (0x10*(i)))
 #define CORTEXM_DWT_MASK(i)	(CORTEXM_DWT_BASE + 0x024 + (0x10*(i)))
 #define CORTEXM_DWT_FUNC(i)	(CORTEXM_DWT_BASE + 0x028 + (0x10*(i)))
 
+/* SysTick Control and Status Register (SYST_CSR) */
+#define CORTEXM_SYST_CSR_COUNTFLAG	(1 << 16)
+#define CORTEXM_SYST_CSR_CLKSOURCE	(1 << 2)
+#define CORTEXM_SYST_CSR_TICKINT	(1 << 1)
+#define CORTEXM_SYST_CSR_ENABLE		(1 << 0)
+
 /* Application Interrupt and Reset Control Register (AIRCR) */
 #define CORTEXM_AIRCR_VECTKEY		(0x05FA << 16)
 /* Bits 31:16 - Read as VECTKETSTAT, 0xFA05 */
@@ -109,6 +133,10 @@ extern long cortexm_wait_timeout;
 #define CORTEXM_DHCSR_C_HALT		(1 << 1)
 #define CORTEXM_DHCSR_C_DEBUGEN		(1 << 0)
 
+/* With TAR set to DHCSR, the MEM-AP banked data registers DB0-DB3
+ * map onto DHCSR, DCRSR, DCRDR and DEMCR */
+enum { DB_DHCSR, DB_DCRSR, DB_DCRDR, DB_DEMCR };
+
 /* Debug Core Register Selector Register (DCRSR) */
 #define CORTEXM_DCRSR_REGWnR		0x00010000
 #define CORTEXM_DCRSR_REGSEL_MASK	0x0000001F
@@ -176,6 +204,10 @@ void cortexm_detach(target *t);
 void cortexm_halt_resume(target *t, bool step);
 int cortexm_run_stub(target *t, uint32_t loadaddr,
                      uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+int cortexm_start_stub(target *t, uint32_t loadaddr,
+                       uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+int cortexm_wait_stub(target *t);
+struct target_ram *cortexm_stub_ram(target *t, size_t len);
 int cortexm_mem_write_sized(
 	target *t, target_addr dest, const void *src, size_t len, enum align align);
 
@@ -41,18 +41,21 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 #define SRAM_BASE		0x20000000
-#define STUB_BUFFER_BASE	ALIGN(SRAM_BASE + sizeof(efm32_flash_write_stub), 4)
 
 static int efm32_flash_erase(struct target_flash *t, target_addr addr, size_t len);
-static int efm32_flash_write(struct target_flash *f,
-			     target_addr dest, const void *src, size_t len);
 
-static const uint16_t efm32_flash_write_stub[] = {
+static const uint16_t efm32_flash_program[] = {
 #include "flashstub/efm32.stub"
 };
 
+static const struct flashloader efm32_flashloader = {
+	.routine = efm32_flash_program,
+	.routine_size = sizeof(efm32_flash_program),
+};
+
 static bool efm32_cmd_erase_all(target *t);
 static bool efm32_cmd_serial(target *t);
 static bool efm32_cmd_efm_info(target *t);
@@ -515,21 +518,17 @@ efm32_v2_di_miscchip_t efm32_v2_read_miscchip(target *t, uint8_t di_version)
 
 
 static void efm32_add_flash(target *t, target_addr addr, size_t length,
-			    size_t page_size)
+			    size_t page_size, uint32_t msc)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
-		DEBUG("calloc: failed in %s\n", __func__);
+	struct flashloader_flash *lf =
+		flashloader_add_flash(t, addr, length, page_size, &efm32_flashloader);
+	if (!lf)
 		return;
-	}
 
-	f->start = addr;
-	f->length = length;
-	f->blocksize = page_size;
-	f->erase = efm32_flash_erase;
-	f->write = efm32_flash_write;
-	f->buf_size = page_size;
-	target_add_flash(t, f);
+	lf->f.erase = efm32_flash_erase;
+	lf->f.buf_size = page_size;
+	/* The program routine takes the MSC base as its parameter */
+	lf->param = msc;
 }
 
 /**
@@ -620,12 +619,15 @@ bool efm32_probe(target *t)
 	t->driver = variant_string;
 	tc_printf(t, "flash size %d page size %d\n", flash_size, flash_page_size);
 	target_add_ram (t, SRAM_BASE, ram_size);
-	efm32_add_flash(t, 0x00000000, flash_size, flash_page_size);
+	efm32_add_flash(t, 0x00000000, flash_size, flash_page_size,
+				device->msc_addr);
 	if (device->user_data_size) { /* optional User Data (UD) section */
-		efm32_add_flash(t, 0x0fe00000, device->user_data_size, flash_page_size);
+		efm32_add_flash(t, 0x0fe00000, device->user_data_size, flash_page_size,
+				device->msc_addr);
 	}
 	if (device->bootloader_size) { /* optional Bootloader (BL) section */
-		efm32_add_flash(t, 0x0fe10000, device->bootloader_size, flash_page_size);
+		efm32_add_flash(t, 0x0fe10000, device->bootloader_size, flash_page_size,
+				device->msc_addr);
 	}
 	target_add_commands(t, efm32_cmd_list, "EFM32");
 
@@ -671,30 +673,6 @@ static int efm32_flash_erase(struct target_flash *f, target_addr addr, size_t le
 	return 0;
 }
 
-/**
- * Write flash page by page
- */
-static int efm32_flash_write(struct target_flash *f,
-			     target_addr dest, const void *src, size_t len)
-{
-	(void)len;
-	target *t = f->t;
-	efm32_device_t const* device = efm32_get_device(t->driver[2] - 32);
-	if (device == NULL) {
-		return true;
-	}
-
-	/* Write flashloader */
-	target_mem_write(t, SRAM_BASE, efm32_flash_write_stub,
-			 sizeof(efm32_flash_write_stub));
-	/* Write Buffer */
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-	/* Run flashloader */
-	return cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len, device->msc_addr);
-
-	return 0;
-}
-
 /**
  * Uses the MSC ERASEMAIN0 command to erase the entire flash
  */
@@ -0,0 +1,218 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements a generic double buffered flash loader.  A small
+ * loop (flashstub/loader.s) stays resident on the target and hands each
+ * filled RAM buffer to a family specific program routine, while the
+ * debugger is already filling the next one.  Progress is reported through
+ * a status word in the control block, so the host only ever polls a single
+ * word instead of halting and restarting the core for every block.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
+#include "flashloader.h"
+
+static const uint16_t flashloader_stub[] = {
+#include "flashstub/loader.stub"
+};
+
+/* Control block layout, must match flashstub/loader.s */
+#define FL_STATUS	0x00
+#define FL_SUBMITTED	0x04
+#define FL_SLOT(i)	(0x1c + 8 * (i))
+
+#define FL_STATUS_ERROR	(1u << 31)
+
+#define FL_MAX_BUFS	4
+#define FL_STACK_SIZE	0x40
+#define FL_TIMEOUT_MS	2000
+
+void flashloader_flash_init(target *t, struct flashloader_flash *lf,
+                           target_addr addr, size_t length, size_t blocksize,
+                           const struct flashloader *loader)
+{
+	struct target_flash *f = &lf->f;
+	f->start = addr;
+	f->length = length;
+	f->blocksize = blocksize;
+	f->write = flashloader_write;
+	f->done = flashloader_done;
+	f->erased = 0xff;
+	lf->loader = loader;
+	target_add_flash(t, f);
+}
+
+struct flashloader_flash *flashloader_add_flash(target *t, target_addr addr,
+                                                size_t length, size_t blocksize,
+                                                const struct flashloader *loader)
+{
+	struct flashloader_flash *lf = calloc(1, sizeof(*lf));
+	if (!lf) {			/* calloc failed: heap exhaustion */
+		DEBUG("calloc: failed in %s\n", __func__);
+		return NULL;
+	}
+
+	flashloader_flash_init(t, lf, addr, length, blocksize, loader);
+	return lf;
+}
+
+static void flashloader_abort(struct flashloader_flash *lf)
+{
+	target *t = lf->f.t;
+
+	lf->ctl = 0;
+	target_halt_request(t);
+	while (target_halt_poll(t, NULL) == TARGET_HALT_RUNNING)
+		;
+}
+
+static int flashloader_start(struct flashloader_flash *lf)
+{
+	struct target_flash *f = &lf->f;
+	target *t = f->t;
+
+	/* Only one loader can own the core at a time */
+	for (struct target_flash *o = t->flash; o; o = o->next) {
+		if ((o == f) || (o->write != flashloader_write))
+			continue;
+		if (((struct flashloader_flash *)o)->ctl && flashloader_done(o))
+			return -1;
+	}
+
+	size_t code = ALIGN(sizeof(flashloader_stub), 4);
+	size_t routine = ALIGN(lf->loader->routine_size, 4);
+	size_t ctl = FL_SLOT(FL_MAX_BUFS);
+	size_t head = code + routine + FL_STACK_SIZE + ctl;
+	size_t bufsize = ALIGN(f->buf_size, 4);
+	struct target_ram *ram = cortexm_stub_ram(t, head + bufsize);
+	if (!ram) {
+		DEBUG("flashloader: no RAM for %d byte buffers\n", (int)bufsize);
+		return -1;
+	}
+
+	target_addr base = ram->start;
+	lf->nbufs = MIN(FL_MAX_BUFS, (ram->length - head) / bufsize);
+	lf->ctl = base + code + routine + FL_STACK_SIZE;
+	lf->bufs = lf->ctl + ctl;
+	lf->submitted = 0;
+
+	uint32_t hdr[] = {
+		0, 0,
+		(base + code) | 1,
+		lf->param,
+		lf->bufs,
+		bufsize,
+		lf->nbufs,
+	};
+	target_mem_write(t, base, flashloader_stub, sizeof(flashloader_stub));
+	target_mem_write(t, base + code, lf->loader->routine,
+	                 lf->loader->routine_size);
+	target_mem_write(t, lf->ctl, hdr, sizeof(hdr));
+	if (target_check_error(t) ||
+	    cortexm_start_stub(t, base, lf->ctl, lf->ctl, 0, 0)) {
+		lf->ctl = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/* Wait until the loader has completed 'count' buffers.  The timeout only
+ * runs while no progress is made, so slow flash is fine. */
+static int flashloader_wait(struct flashloader_flash *lf, uint32_t count)
+{
+	target *t = lf->f.t;
+	platform_timeout timeout;
+	uint32_t last = ~0;
+
+	while (1) {
+		uint32_t status = target_mem_read32(t, lf->ctl + FL_STATUS);
+		if (target_check_error(t)) {
+			flashloader_abort(lf);
+			return -1;
+		}
+		if (status & FL_STATUS_ERROR) {
+			DEBUG("flashloader: routine failed with %08"PRIx32"\n",
+			      status & ~FL_STATUS_ERROR);
+			lf->ctl = 0;
+			cortexm_wait_stub(t);
+			return -1;
+		}
+		if (status >= count)
+			return 0;
+		if (status != last) {
+			last = status;
+			platform_timeout_set(&timeout, FL_TIMEOUT_MS);
+		} else if (platform_timeout_is_expired(&timeout) ||
+		           (target_halt_poll(t, NULL) != TARGET_HALT_RUNNING)) {
+			DEBUG("flashloader: stalled after %"PRIu32" buffers\n",
+			      status);
+			flashloader_abort(lf);
+			return -1;
+		}
+	}
+}
+
+int flashloader_write(struct target_flash *f,
+                      target_addr dest, const void *src, size_t len)
+{
+	struct flashloader_flash *lf = (struct flashloader_flash *)f;
+	target *t = f->t;
+
+	if (!lf->ctl && flashloader_start(lf))
+		return -1;
+
+	/* Wait for the loader to release the slot we are about to fill */
+	if ((lf->submitted >= lf->nbufs) &&
+	    flashloader_wait(lf, lf->submitted - lf->nbufs + 1))
+		return -1;
+
+	unsigned slot = lf->submitted % lf->nbufs;
+	uint32_t desc[2] = { dest, len };
+	target_mem_write(t, lf->bufs + slot * ALIGN(f->buf_size, 4), src, len);
+	target_mem_write(t, lf->ctl + FL_SLOT(slot), desc, sizeof(desc));
+	target_mem_write32(t, lf->ctl + FL_SUBMITTED, ++lf->submitted);
+	if (target_check_error(t)) {
+		flashloader_abort(lf);
+		return -1;
+	}
+	return 0;
+}
+
+int flashloader_done(struct target_flash *f)
+{
+	struct flashloader_flash *lf = (struct flashloader_flash *)f;
+	target *t = f->t;
+
+	if (!lf->ctl)
+		return 0;
+
+	if (flashloader_wait(lf, lf->submitted))
+		return -1;
+
+	/* An empty buffer ends the loader loop */
+	unsigned slot = lf->submitted % lf->nbufs;
+	target_mem_write32(t, lf->ctl + FL_SLOT(slot) + 4, 0);
+	target_mem_write32(t, lf->ctl + FL_SUBMITTED, ++lf->submitted);
+	lf->ctl = 0;
+
+	return cortexm_wait_stub(t) ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHLOADER_H
+#define __FLASHLOADER_H
+
+/* Family specific part of the flash loader: a routine called by
+ * flashstub/loader.s for each buffer as routine(dest, src, len, param).
+ * It must preserve r4-r7 and return 0 on success. */
+struct flashloader {
+	const uint16_t *routine;
+	size_t routine_size;
+};
+
+struct flashloader_flash {
+	struct target_flash f;
+	const struct flashloader *loader;
+	uint32_t param;
+	/* Loader state while programming, ctl is 0 when not running */
+	target_addr ctl;
+	target_addr bufs;
+	unsigned nbufs;
+	uint32_t submitted;
+};
+
+/* For drivers embedding struct flashloader_flash in their own flash */
+void flashloader_flash_init(target *t, struct flashloader_flash *lf,
+                           target_addr addr, size_t length, size_t blocksize,
+                           const struct flashloader *loader);
+struct flashloader_flash *flashloader_add_flash(target *t, target_addr addr,
+                                                size_t length, size_t blocksize,
+                                                const struct flashloader *loader);
+int flashloader_write(struct target_flash *f,
+                      target_addr dest, const void *src, size_t len);
+int flashloader_done(struct target_flash *f);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2015  Richard Meadows
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Flash loader program routine for EFM32, see loader.s.
+ * Writes one word at a time through the MSC.
+ *
+ * r0: destination, r1: source, r2: length in bytes, r3: MSC base
+ * Returns the MSC status bits if the write is refused.
+ */
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.equ	EFM32_MSC_WRITECTRL, 0x008
+	.equ	EFM32_MSC_WRITECMD, 0x00c
+	.equ	EFM32_MSC_ADDRB, 0x010
+	.equ	EFM32_MSC_WDATA, 0x018
+	.equ	EFM32_MSC_STATUS, 0x01c
+	.equ	EFM32_MSC_LOCK_LOCKKEY, 0x1b71
+
+	.equ	EFM32_MSC_WRITECMD_LADDRIM, (1 << 0)
+	.equ	EFM32_MSC_WRITECMD_WRITEONCE, (1 << 3)
+
+	.equ	EFM32_MSC_STATUS_LOCKED, (1 << 1)
+	.equ	EFM32_MSC_STATUS_INVADDR, (1 << 2)
+
+	.global efm32_flash_program
+	.thumb_func
+efm32_flash_program:
+	push	{r4, r5}
+	adds	r2, r0, r2
+	/* The lock register moved on Series 1 parts */
+	movs	r5, #0x3c
+	ldr	r4, =0x400e0000
+	cmp	r3, r4
+	bne	1f
+	movs	r5, #0x40
+1:
+	ldr	r4, =EFM32_MSC_LOCK_LOCKKEY
+	str	r4, [r3, r5]
+	movs	r4, #1
+	str	r4, [r3, #EFM32_MSC_WRITECTRL]
+2:
+	cmp	r0, r2
+	beq	5f
+	str	r0, [r3, #EFM32_MSC_ADDRB]
+	movs	r4, #EFM32_MSC_WRITECMD_LADDRIM
+	str	r4, [r3, #EFM32_MSC_WRITECMD]
+	ldr	r4, [r3, #EFM32_MSC_STATUS]
+	movs	r5, #(EFM32_MSC_STATUS_LOCKED | EFM32_MSC_STATUS_INVADDR)
+	ands	r4, r5
+	bne	6f
+3:
+	ldr	r4, [r3, #EFM32_MSC_STATUS]
+	lsls	r4, r4, #28	/* EFM32_MSC_STATUS_WDATAREADY */
+	bpl	3b
+	ldr	r4, [r1]
+	str	r4, [r3, #EFM32_MSC_WDATA]
+	movs	r4, #EFM32_MSC_WRITECMD_WRITEONCE
+	str	r4, [r3, #EFM32_MSC_WRITECMD]
+4:
+	ldr	r4, [r3, #EFM32_MSC_STATUS]
+	lsls	r4, r4, #31	/* EFM32_MSC_STATUS_BUSY */
+	bne	4b
+	adds	r0, #4
+	adds	r1, #4
+	b	2b
+5:
+	movs	r4, #0
+6:
+	mov	r0, r4
+	pop	{r4, r5}
+	bx	lr
+
+	.align	2
+	.pool
@@ -0,0 +1,65 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2015  Black Sphere Technologies Ltd.
+ * Written by Gareth McMullin <gareth@blacksphere.co.nz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Flash loader program routine for TI Stellaris/Tiva, see loader.s.
+ * Writes one word at a time through FMA/FMD/FMC.
+ *
+ * r0: destination, r1: source, r2: length in bytes
+ */
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.equ	LMI_FLASH_BASE, 0x400FD000
+	.equ	LMI_FLASH_FMA, 0x000
+	.equ	LMI_FLASH_FMD, 0x004
+	.equ	LMI_FLASH_FMC, 0x008
+	.equ	LMI_FLASH_FMC_WRITE, (1 << 0)
+	.equ	LMI_FLASH_FMC_WRKEY, 0xA4420000
+
+	.global lmi_flash_program
+	.thumb_func
+lmi_flash_program:
+	push	{r4, r5}
+	adds	r2, r0, r2
+	ldr	r3, =LMI_FLASH_BASE
+	ldr	r4, =(LMI_FLASH_FMC_WRKEY | LMI_FLASH_FMC_WRITE)
+1:
+	cmp	r0, r2
+	beq	3f
+	str	r0, [r3, #LMI_FLASH_FMA]
+	ldr	r5, [r1]
+	str	r5, [r3, #LMI_FLASH_FMD]
+	str	r4, [r3, #LMI_FLASH_FMC]
+2:
+	ldr	r5, [r3, #LMI_FLASH_FMC]
+	lsls	r5, r5, #31	/* LMI_FLASH_FMC_WRITE */
+	bne	2b
+	adds	r0, #4
+	adds	r1, #4
+	b	1b
+3:
+	movs	r0, #0
+	pop	{r4, r5}
+	bx	lr
+
+	.align	2
+	.pool
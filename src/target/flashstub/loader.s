@@ -0,0 +1,87 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Generic flash loader loop, see flashloader.c for the host side.
+ *
+ * The debugger fills a ring of RAM buffers while the family specific
+ * program routine writes earlier ones to flash.  Everything is described
+ * by a control block passed in r0:
+ *
+ *   0x00 status     buffers completed, bit 31 set with the routine's
+ *                   return code on error (written by the stub)
+ *   0x04 submitted  buffers handed over by the debugger
+ *   0x08 routine    address of the program routine (thumb bit set)
+ *   0x0c param      passed to the routine in r3
+ *   0x10 buf_base   address of buffer 0
+ *   0x14 buf_size   size of each buffer
+ *   0x18 nbufs      number of buffers in the ring
+ *   0x1c slots      {dest, len} for each buffer, len 0 ends the loop
+ *
+ * r1 holds the initial stack pointer for the routine.
+ * The routine is called as routine(dest, src, len, param), must preserve
+ * r4-r7 and return 0 in r0 on success.
+ */
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.global loader_stub
+	.thumb_func
+loader_stub:
+	mov	sp, r1
+	mov	r7, r0		/* control block */
+	movs	r6, #0		/* buffers completed */
+	movs	r5, #0		/* current slot */
+1:
+	ldr	r0, [r7, #0x04]
+	cmp	r0, r6
+	beq	1b
+	lsls	r1, r5, #3
+	adds	r1, r7
+	ldr	r0, [r1, #0x1c]
+	ldr	r2, [r1, #0x20]
+	cmp	r2, #0
+	beq	3f
+	ldr	r1, [r7, #0x14]
+	muls	r1, r5, r1
+	ldr	r3, [r7, #0x10]
+	adds	r1, r3
+	ldr	r3, [r7, #0x0c]
+	ldr	r4, [r7, #0x08]
+	blx	r4
+	cmp	r0, #0
+	bne	2f
+	adds	r6, #1
+	str	r6, [r7, #0x00]
+	adds	r5, #1
+	ldr	r0, [r7, #0x18]
+	cmp	r5, r0
+	bne	1b
+	movs	r5, #0
+	b	1b
+2:
+	movs	r1, #1
+	lsls	r1, r1, #31
+	orrs	r0, r1
+	str	r0, [r7, #0x00]
+	bkpt	#1
+3:
+	bkpt	#0
@@ -0,0 +1,67 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Flash loader program routine for nRF51/nRF52, see loader.s.
+ * A word store to flash stalls the bus until the NVMC has programmed it,
+ * so READY is polled before every store and the core never waits on the
+ * bus.  The NVMC is returned to read only mode once the buffer is done.
+ *
+ * r0: destination, r1: source, r2: length in bytes, r3: NVMC base
+ * The NVMC reports no errors, so this always returns 0.
+ */
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.equ	NRF51_NVMC_READY, 0x400
+	.equ	NRF51_NVMC_CONFIG, 0x504
+	.equ	NRF51_NVMC_CONFIG_REN, 0x0
+	.equ	NRF51_NVMC_CONFIG_WEN, 0x1
+
+	.global nrf51_flash_program
+	.thumb_func
+nrf51_flash_program:
+	push	{r4, r5, r6}
+	adds	r2, r0, r2
+	ldr	r5, =NRF51_NVMC_READY
+	adds	r5, r3, r5
+	ldr	r6, =NRF51_NVMC_CONFIG
+	adds	r6, r3, r6
+	movs	r4, #NRF51_NVMC_CONFIG_WEN
+	str	r4, [r6]
+1:
+	ldr	r4, [r5]
+	cmp	r4, #0
+	beq	1b
+	cmp	r0, r2
+	beq	2f
+	ldr	r4, [r1]
+	str	r4, [r0]
+	adds	r0, #4
+	adds	r1, #4
+	b	1b
+2:
+	movs	r0, #NRF51_NVMC_CONFIG_REN
+	str	r0, [r6]
+	pop	{r4, r5, r6}
+	bx	lr
+
+	.align	2
+	.pool
@@ -0,0 +1,67 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2015  Black Sphere Technologies Ltd.
+ * Written by Gareth McMullin <gareth@blacksphere.co.nz>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Flash loader program routine for STM32F0/F1/F3, see loader.s.
+ * Writes one halfword at a time with PG set, waiting for BSY to clear.
+ *
+ * r0: destination, r1: source, r2: length in bytes, r3: FPEC base
+ * Returns the PGERR/WRPRTERR status bits on failure.
+ */
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.equ	STM32F1_FLASH_SR, 0x0c
+	.equ	STM32F1_FLASH_CR, 0x10
+	.equ	STM32F1_FLASH_CR_PG, (1 << 0)
+	.equ	STM32F1_FLASH_SR_ERROR_MASK, 0x14
+
+	.global stm32f1_flash_program
+	.thumb_func
+stm32f1_flash_program:
+	push	{r4, r5}
+	adds	r2, r0, r2
+	movs	r4, #STM32F1_FLASH_CR_PG
+	str	r4, [r3, #STM32F1_FLASH_CR]
+1:
+	cmp	r0, r2
+	beq	3f
+	ldrh	r4, [r1]
+	strh	r4, [r0]
+2:
+	ldr	r4, [r3, #STM32F1_FLASH_SR]
+	lsls	r5, r4, #31	/* STM32F1_FLASH_SR_BSY */
+	bne	2b
+	movs	r5, #STM32F1_FLASH_SR_ERROR_MASK
+	ands	r4, r5
+	bne	4f
+	adds	r0, #2
+	adds	r1, #2
+	b	1b
+3:
+	movs	r4, #0
+4:
+	/* Clear any error flags and leave programming mode */
+	str	r4, [r3, #STM32F1_FLASH_SR]
+	movs	r5, #0
+	str	r5, [r3, #STM32F1_FLASH_CR]
+	mov	r0, r4
+	pop	{r4, r5}
+	bx	lr
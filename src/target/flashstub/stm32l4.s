@@ -0,0 +1,94 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/* Flash loader program routine for STM32L4/G0/G4, see loader.s.
+ * With bit 0 of the parameter set, whole aligned rows of 32 double words
+ * are written back to back in fast programming mode (FSTPG), which needs
+ * the bank to have been mass erased.  Anything else is written one
+ * double word at a time with PG set.
+ *
+ * r0: destination, r1: source, r2: length in bytes, r3: FPEC base | fast
+ * Returns the FLASH_SR error bits on failure.
+ */
+
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+
+	.equ	STM32L4_FLASH_SR, 0x10
+	.equ	STM32L4_FLASH_CR, 0x14
+	.equ	STM32L4_FLASH_CR_PG, (1 << 0)
+	.equ	STM32L4_ROW_SIZE, 256
+
+	.global stm32l4_flash_program
+	.thumb_func
+stm32l4_flash_program:
+	push	{r4, r5, r6}
+	adds	r2, r0, r2
+	movs	r6, #1
+	ands	r6, r3
+	bics	r3, r6
+1:
+	cmp	r0, r2
+	beq	5f
+	/* Fast programming only for whole, aligned rows */
+	cmp	r6, #0
+	beq	2f
+	lsls	r4, r0, #24
+	bne	2f
+	subs	r4, r2, r0
+	cmp	r4, #(STM32L4_ROW_SIZE - 1)
+	bls	2f
+	ldr	r4, flash_cr_fstpg
+	str	r4, [r3, #STM32L4_FLASH_CR]
+	movs	r5, #(STM32L4_ROW_SIZE / 4)
+3:
+	ldm	r1!, {r4}
+	stm	r0!, {r4}
+	subs	r5, #1
+	bne	3b
+	b	4f
+2:
+	movs	r4, #STM32L4_FLASH_CR_PG
+	str	r4, [r3, #STM32L4_FLASH_CR]
+	ldm	r1!, {r4, r5}
+	stm	r0!, {r4, r5}
+4:
+	ldr	r4, [r3, #STM32L4_FLASH_SR]
+	lsrs	r5, r4, #17	/* STM32L4_FLASH_SR_BSY */
+	bcs	4b
+	ldr	r5, flash_sr_error_mask
+	ands	r4, r5
+	beq	1b
+	b	6f
+5:
+	movs	r4, #0
+6:
+	/* Clear any error flags and leave programming mode */
+	str	r4, [r3, #STM32L4_FLASH_SR]
+	movs	r5, #0
+	str	r5, [r3, #STM32L4_FLASH_CR]
+	mov	r0, r4
+	pop	{r4, r5, r6}
+	bx	lr
+
+	.align	2
+flash_cr_fstpg:
+	.word	(1 << 18)
+flash_sr_error_mask:
+	.word	0xC3FA
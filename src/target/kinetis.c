@@ -55,6 +55,8 @@
 #define FTFA_FSTAT_FPVIOL   (1 << 4)
 #define FTFA_FSTAT_MGSTAT0  (1 << 0)
 
+#define FTFA_FCNFG_RAMRDY   (1 << 1)
+
 #define FTFA_CMD_CHECK_ERASE       0x01
 #define FTFA_CMD_PROGRAM_CHECK     0x02
 #define FTFA_CMD_READ_RESOURCE     0x03
@@ -62,6 +64,7 @@
 /* Part of the FTFE module for K64 */
 #define FTFE_CMD_PROGRAM_PHRASE    0x07
 #define FTFA_CMD_ERASE_SECTOR      0x09
+#define FTFE_CMD_PROGRAM_SECTION   0x0B
 #define FTFA_CMD_CHECK_ERASE_ALL   0x40
 #define FTFA_CMD_READ_ONCE         0x41
 #define FTFA_CMD_PROGRAM_ONCE      0x43
@@ -71,6 +74,11 @@
 #define KL_WRITE_LEN 4
 /* 8 byte phrases need to be written to the k64 flash */
 #define K64_WRITE_LEN 8
+/* Program Section takes its data from the programming acceleration RAM
+ * (FlexRAM) and counts it in 128-bit units */
+#define FTFE_SECTION_RAM   0x14000000
+#define FTFE_SECTION_SIZE  0x1000
+#define FTFE_SECTION_ALIGN 16
 
 static bool kinetis_cmd_unsafe(target *t, int argc, char *argv[]);
 static bool unsafe_enabled;
@@ -99,6 +107,7 @@ static int kl_gen_flash_done(struct target_flash *f);
 struct kinetis_flash {
 	struct target_flash f;
 	uint8_t write_len;
+	bool no_section;	/* Program Section was refused, use phrases */
 };
 
 static void kl_gen_add_flash(target *t, uint32_t addr, size_t length,
@@ -120,6 +129,8 @@ static void kl_gen_add_flash(target *t, uint32_t addr, size_t length,
 	f->write = kl_gen_flash_write;
 	f->done = kl_gen_flash_done;
 	f->erased = 0xff;
+	if ((write_len == K64_WRITE_LEN) && (erasesize <= FTFE_SECTION_SIZE))
+		f->buf_size = erasesize;
 	kf->write_len = write_len;
 	target_add_flash(t, f);
 }
@@ -280,6 +291,28 @@ static int kl_gen_flash_write(struct target_flash *f,
 		    FLASH_SECURITY_BYTE_UNSECURED;
 	}
 
+	/* Stage whole sections in FlexRAM and program them with one command */
+	if ((kf->write_len == K64_WRITE_LEN) && !kf->no_section &&
+	    !(dest % FTFE_SECTION_ALIGN) && !(len % FTFE_SECTION_ALIGN) &&
+	    (len <= FTFE_SECTION_SIZE)) {
+		if (!(target_mem_read8(f->t, FTFA_FCNFG) & FTFA_FCNFG_RAMRDY)) {
+			/* FlexRAM is configured for EEPROM */
+			kf->no_section = true;
+		} else {
+			uint32_t vals[2] = { (len / FTFE_SECTION_ALIGN) << 16, 0 };
+			target_mem_write(f->t, FTFE_SECTION_RAM, src, len);
+			if (kl_gen_command(f->t, FTFE_CMD_PROGRAM_SECTION, dest,
+			                   (uint8_t*)vals))
+				return 0;
+			/* ACCERR rejects the command before anything is
+			 * programmed, so phrases can still be tried */
+			if (target_mem_read8(f->t, FTFA_FSTAT) & FTFA_FSTAT_FPVIOL)
+				return 1;
+			DEBUG("kinetis: Program Section refused, using phrases\n");
+			kf->no_section = true;
+		}
+	}
+
 	/* Determine write command based on the alignment. */
 	uint8_t write_cmd;
 	if (kf->write_len == K64_WRITE_LEN) {
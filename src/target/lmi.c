@@ -28,9 +28,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
-
-#define SRAM_BASE            0x20000000
-#define STUB_BUFFER_BASE     ALIGN(SRAM_BASE + sizeof(lmi_flash_write_stub), 4)
+#include "flashloader.h"
 
 #define BLOCK_SIZE           0x400
 
@@ -48,30 +46,24 @@
 #define LMI_FLASH_FMC_WRKEY  0xA4420000
 
 static int lmi_flash_erase(struct target_flash *f, target_addr addr, size_t len);
-static int lmi_flash_write(struct target_flash *f,
-                           target_addr dest, const void *src, size_t len);
 
 static const char lmi_driver_str[] = "TI Stellaris/Tiva";
 
-static const uint16_t lmi_flash_write_stub[] = {
+static const uint16_t lmi_flash_program[] = {
 #include "flashstub/lmi.stub"
 };
 
+static const struct flashloader lmi_flashloader = {
+	.routine = lmi_flash_program,
+	.routine_size = sizeof(lmi_flash_program),
+};
+
 static void lmi_add_flash(target *t, size_t length)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
-		DEBUG("calloc: failed in %s\n", __func__);
-		return;
-	}
-
-	f->start = 0;
-	f->length = length;
-	f->blocksize = 0x400;
-	f->erase = lmi_flash_erase;
-	f->write = lmi_flash_write;
-	f->erased = 0xff;
-	target_add_flash(t, f);
+	struct flashloader_flash *lf =
+		flashloader_add_flash(t, 0, length, BLOCK_SIZE, &lmi_flashloader);
+	if (lf)
+		lf->f.erase = lmi_flash_erase;
 }
 
 bool lmi_probe(target *t)
@@ -125,20 +117,3 @@ int lmi_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 	}
 	return 0;
 }
-
-int lmi_flash_write(struct target_flash *f,
-                    target_addr dest, const void *src, size_t len)
-{
-	target  *t = f->t;
-
-	target_check_error(t);
-
-	target_mem_write(t, SRAM_BASE, lmi_flash_write_stub,
-	                 sizeof(lmi_flash_write_stub));
-	target_mem_write(t, STUB_BUFFER_BASE, src, len);
-
-	if (target_check_error(t))
-		return -1;
-
-	return cortexm_run_stub(t, SRAM_BASE, dest, STUB_BUFFER_BASE, len, 0);
-}
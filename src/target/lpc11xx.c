@@ -25,6 +25,7 @@
 #include "lpc_common.h"
 
 #define IAP_PGM_CHUNKSIZE	512	/* should fit in RAM on any device */
+#define IAP_PGM_CHUNKSIZE_4K	1024	/* double buffered with 4K of RAM */
 
 #define MIN_RAM_SIZE            1024
 #define RAM_USAGE_FOR_IAP_ROUTINES	32	/* IAP routines use 32 bytes at top of ram */
@@ -35,15 +36,19 @@
 #define LPC11XX_DEVICE_ID  0x400483F4
 #define LPC8XX_DEVICE_ID   0x400483F8
 
-void lpc11xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize)
+void lpc11xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize,
+                       size_t ram_size)
 {
 	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
 	lf->f.blocksize = erasesize;
-	lf->f.buf_size = IAP_PGM_CHUNKSIZE;
+	if (ram_size >= 0x1000)
+		lf->f.buf_size = IAP_PGM_CHUNKSIZE_4K;
+	else
+		lf->f.buf_size = IAP_PGM_CHUNKSIZE;
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = IAP_ENTRYPOINT;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	lf->iap_msp = IAP_RAM_BASE + ram_size - RAM_USAGE_FOR_IAP_ROUTINES;
 }
 
 bool
@@ -88,14 +93,14 @@ lpc11xx_probe(target *t)
 	case 0x2980002B:	/* lpc11u24x/401 */
 		t->driver = "LPC11xx";
 		target_add_ram(t, 0x10000000, 0x2000);
-		lpc11xx_add_flash(t, 0x00000000, 0x20000, 0x1000);
+		lpc11xx_add_flash(t, 0x00000000, 0x20000, 0x1000, MIN_RAM_SIZE);
 		return true;
 
 	case 0x0A24902B:
 	case 0x1A24902B:
 		t->driver = "LPC1112";
 		target_add_ram(t, 0x10000000, 0x1000);
-		lpc11xx_add_flash(t, 0x00000000, 0x10000, 0x1000);
+		lpc11xx_add_flash(t, 0x00000000, 0x10000, 0x1000, 0x1000);
 		return true;
 	}
 
@@ -108,7 +113,7 @@ lpc11xx_probe(target *t)
 	case 0x00008122:  /* LPC812M101JDH20 / LPC812M101JTB16 */
 		t->driver = "LPC81x";
 		target_add_ram(t, 0x10000000, 0x1000);
-		lpc11xx_add_flash(t, 0x00000000, 0x4000, 0x400);
+		lpc11xx_add_flash(t, 0x00000000, 0x4000, 0x400, MIN_RAM_SIZE);
 		return true;
 	case 0x00008221:  /* LPC822M101JHI33 */
 	case 0x00008222:  /* LPC822M101JDH20 */
@@ -116,7 +121,7 @@ lpc11xx_probe(target *t)
 	case 0x00008242:  /* LPC824M201JDH20 */
 		t->driver = "LPC82x";
 		target_add_ram(t, 0x10000000, 0x2000);
-		lpc11xx_add_flash(t, 0x00000000, 0x8000, 0x400);
+		lpc11xx_add_flash(t, 0x00000000, 0x8000, 0x400, 0x1000);
 		return true;
 	case 0x0003D440:	/* LPC11U34/311  */
 	case 0x0001cc40:	/* LPC11U34/421  */
@@ -128,12 +133,12 @@ lpc11xx_probe(target *t)
 	case 0x00007C40:	/* LPC11U37FBD64/501  */
 		t->driver = "LPC11U3x";
 		target_add_ram(t, 0x10000000, 0x2000);
-		lpc11xx_add_flash(t, 0x00000000, 0x20000, 0x1000);
+		lpc11xx_add_flash(t, 0x00000000, 0x20000, 0x1000, 0x2000);
 		return true;
 	case 0x00050080:	/* lpc1115XL */
 		t->driver = "LPC1100XL";
 		target_add_ram(t, 0x10000000, 0x2000);
-		lpc11xx_add_flash(t, 0x00000000, 0x20000, 0x1000);
+		lpc11xx_add_flash(t, 0x00000000, 0x20000, 0x1000, 0x2000);
 		return true;
 	}
 
@@ -25,9 +25,8 @@
 #include "cortexm.h"
 #include "lpc_common.h"
 
-#define IAP_PGM_CHUNKSIZE	512	/* should fit in RAM on any device */
+#define IAP_PGM_CHUNKSIZE	4096	/* double buffered in 12K of RAM */
 
-#define MIN_RAM_SIZE            1024
 #define RAM_USAGE_FOR_IAP_ROUTINES	32	/* IAP routines use 32 bytes at top of ram */
 
 #define IAP_ENTRYPOINT	0x03000205
@@ -35,7 +34,8 @@
 
 #define LPC15XX_DEVICE_ID  0x400743F8
 
-void lpc15xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize)
+void lpc15xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize,
+                       size_t ram_size)
 {
 	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
 	lf->f.blocksize = erasesize;
@@ -43,7 +43,7 @@ void lpc15xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize)
 	lf->f.write = lpc_flash_write_magic_vect;
 	lf->iap_entry = IAP_ENTRYPOINT;
 	lf->iap_ram = IAP_RAM_BASE;
-	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
+	lf->iap_msp = IAP_RAM_BASE + ram_size - RAM_USAGE_FOR_IAP_ROUTINES;
 }
 
 bool
@@ -71,7 +71,7 @@ lpc15xx_probe(target *t)
 	if (ram_size) {
 		t->driver = "LPC15xx";
 		target_add_ram(t, 0x02000000, ram_size);
-		lpc15xx_add_flash(t, 0x00000000, 0x40000, 0x1000);
+		lpc15xx_add_flash(t, 0x00000000, 0x40000, 0x1000, ram_size);
 		return true;
 	}
 
@@ -32,6 +32,10 @@ struct flash_param {
 	uint32_t result;
 } __attribute__((aligned(4)));
 
+/* How long the core clock is counted for */
+#define LPC_CLK_MEASURE_MS	20
+/* SysTick reload while counting, wraps every 80ms at 200MHz */
+#define LPC_SYST_RELOAD		0xffffff
 
 struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
 {
@@ -48,12 +52,13 @@ struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
 	f->length = length;
 	f->erase = lpc_flash_erase;
 	f->write = lpc_flash_write;
+	f->done = lpc_flash_done;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 	return lf;
 }
 
-enum iap_status lpc_iap_call(struct lpc_flash *f, enum iap_cmd cmd, ...)
+static void lpc_iap_vstart(struct lpc_flash *f, enum iap_cmd cmd, va_list ap)
 {
 	target *t = f->f.t;
 	struct flash_param param = {
@@ -66,11 +71,8 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, enum iap_cmd cmd, ...)
 		f->wdt_kick(t);
 
 	/* fill out the remainder of the parameters */
-	va_list ap;
-	va_start(ap, cmd);
 	for (int i = 0; i < 4; i++)
 		param.words[i] = va_arg(ap, uint32_t);
-	va_end(ap);
 
 	/* copy the structure to RAM */
 	target_mem_write(t, f->iap_ram, &param, sizeof(param));
@@ -85,13 +87,139 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, enum iap_cmd cmd, ...)
 	regs[REG_PC] = f->iap_entry;
 	target_regs_write(t, regs);
 
-	/* start the target and wait for it to halt again */
+	/* start the target, lpc_iap_finish() waits for it to halt again */
+	target_halt_resume(t, false);
+	f->iap_busy = true;
+}
+
+static void lpc_iap_start(struct lpc_flash *f, enum iap_cmd cmd, ...)
+{
+	va_list ap;
+	va_start(ap, cmd);
+	lpc_iap_vstart(f, cmd, ap);
+	va_end(ap);
+}
+
+static enum iap_status lpc_iap_finish(struct lpc_flash *f)
+{
+	target *t = f->f.t;
+
+	while (!target_halt_poll(t, NULL));
+	f->iap_busy = false;
+
+	/* copy back just the result */
+	return target_mem_read32(t, f->iap_ram +
+	                         offsetof(struct flash_param, result));
+}
+
+/* Collect a PROGRAM left running by lpc_flash_write(), on any bank */
+static enum iap_status lpc_iap_idle(target *t)
+{
+	enum iap_status status = IAP_STATUS_CMD_SUCCESS;
+
+	for (struct target_flash *tf = t->flash; tf; tf = tf->next) {
+		struct lpc_flash *f = (struct lpc_flash *)tf;
+		if ((tf->done != lpc_flash_done) || !f->iap_busy)
+			continue;
+		enum iap_status tmp = lpc_iap_finish(f);
+		if (status == IAP_STATUS_CMD_SUCCESS)
+			status = tmp;
+	}
+	return status;
+}
+
+enum iap_status lpc_iap_call(struct lpc_flash *f, enum iap_cmd cmd, ...)
+{
+	enum iap_status status = lpc_iap_idle(f->f.t);
+	if (status != IAP_STATUS_CMD_SUCCESS)
+		return status;
+
+	va_list ap;
+	va_start(ap, cmd);
+	lpc_iap_vstart(f, cmd, ap);
+	va_end(ap);
+	return lpc_iap_finish(f);
+}
+
+/* The IAP routines time their program and erase cycles from the clock
+ * they are passed, so CPU_CLK_KHZ under-times them once the application
+ * has switched the core to a PLL.  Count SysTick at the core clock with
+ * the core parked on a branch-to-self, between two ticks of our own time
+ * base so its resolution (100ms on some platforms) doesn't matter.
+ * SysTick wraps are counted through COUNTFLAG, so fast cores can't alias.
+ * Measured once per flash session, returns 0 if a running PROGRAM failed.
+ */
+uint32_t lpc_flash_clk_khz(struct lpc_flash *f)
+{
+	target *t = f->f.t;
+
+	if (f->clk_khz && (f->clk_session == t->flash_session))
+		return f->clk_khz;
+	if (lpc_iap_idle(t))
+		return 0;
+
+	uint32_t csr = target_mem_read32(t, CORTEXM_SYST_CSR);
+	uint32_t rvr = target_mem_read32(t, CORTEXM_SYST_RVR);
+
+	/* "b ." where the parameter block goes */
+	target_mem_write16(t, f->iap_ram, 0xe7fe);
+	uint32_t regs[t->regs_size / sizeof(uint32_t)];
+	target_regs_read(t, regs);
+	regs[REG_PC] = f->iap_ram;
+	target_regs_write(t, regs);
+
+	target_mem_write32(t, CORTEXM_SYST_CSR, 0);
+	target_mem_write32(t, CORTEXM_SYST_RVR, LPC_SYST_RELOAD);
+	target_mem_write32(t, CORTEXM_SYST_CVR, 0);
+	target_mem_write32(t, CORTEXM_SYST_CSR,
+	                   CORTEXM_SYST_CSR_CLKSOURCE | CORTEXM_SYST_CSR_ENABLE);
 	target_halt_resume(t, false);
+
+	/* Start on a tick edge of our time base */
+	uint32_t t0 = platform_time_ms();
+	while (platform_time_ms() == t0);
+	t0 = platform_time_ms();
+	target_mem_read32(t, CORTEXM_SYST_CSR);	/* clears COUNTFLAG */
+	uint32_t start = target_mem_read32(t, CORTEXM_SYST_CVR);
+
+	/* and end on the first edge a whole window later */
+	uint32_t wraps = 0;
+	uint32_t elapsed;
+	while ((elapsed = platform_time_ms() - t0) < LPC_CLK_MEASURE_MS) {
+		if (target_mem_read32(t, CORTEXM_SYST_CSR) &
+		    CORTEXM_SYST_CSR_COUNTFLAG)
+			wraps++;
+		if (target_check_error(t))
+			break;
+	}
+	uint32_t end = target_mem_read32(t, CORTEXM_SYST_CVR);
+	if (target_mem_read32(t, CORTEXM_SYST_CSR) &
+	    CORTEXM_SYST_CSR_COUNTFLAG) {
+		wraps++;
+		end = target_mem_read32(t, CORTEXM_SYST_CVR);
+	}
+
+	target_halt_request(t);
 	while (!target_halt_poll(t, NULL));
 
-	/* copy back just the parameters structure */
-	target_mem_read(t, &param, f->iap_ram, sizeof(param));
-	return param.result;
+	/* Hand SysTick back to the application */
+	target_mem_write32(t, CORTEXM_SYST_CSR, 0);
+	target_mem_write32(t, CORTEXM_SYST_RVR, rvr);
+	target_mem_write32(t, CORTEXM_SYST_CVR, 0);
+	target_mem_write32(t, CORTEXM_SYST_CSR,
+	                   csr & ~CORTEXM_SYST_CSR_COUNTFLAG);
+
+	/* The counter counts down, from LPC_SYST_RELOAD after each wrap */
+	int64_t ticks = (int64_t)wraps * (LPC_SYST_RELOAD + 1) +
+	                (int64_t)start - end;
+	uint32_t khz = 0;
+	if (!target_check_error(t) && (ticks > 0))
+		khz = ticks / elapsed;
+	/* Never pass less than the IRC the part starts on */
+	f->clk_khz = MAX(khz, CPU_CLK_KHZ);
+	f->clk_session = t->flash_session;
+	DEBUG("LPC IAP clock %" PRIu32 " kHz\n", f->clk_khz);
+	return f->clk_khz;
 }
 
 static uint8_t lpc_sector_for_addr(struct lpc_flash *f, uint32_t addr)
@@ -104,12 +232,14 @@ int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
 	struct lpc_flash *f = (struct lpc_flash *)tf;
 	uint32_t start = lpc_sector_for_addr(f, addr);
 	uint32_t end = lpc_sector_for_addr(f, addr + len - 1);
+	uint32_t clk_khz = lpc_flash_clk_khz(f);
 
-	if (lpc_iap_call(f, IAP_CMD_PREPARE, start, end, f->bank))
+	if (!clk_khz ||
+	    lpc_iap_call(f, IAP_CMD_PREPARE, start, end, f->bank))
 		return -1;
 
 	/* and now erase them */
-	if (lpc_iap_call(f, IAP_CMD_ERASE, start, end, CPU_CLK_KHZ, f->bank))
+	if (lpc_iap_call(f, IAP_CMD_ERASE, start, end, clk_khz, f->bank))
 		return -2;
 
 	/* check erase ok */
@@ -119,21 +249,58 @@ int lpc_flash_erase(struct target_flash *tf, target_addr addr, size_t len)
 	return 0;
 }
 
+static target_addr lpc_buf_addr(struct lpc_flash *f, unsigned buf)
+{
+	return ALIGN(f->iap_ram + sizeof(struct flash_param), 4) +
+	       buf * f->f.buf_size;
+}
+
 int lpc_flash_write(struct target_flash *tf,
                     target_addr dest, const void *src, size_t len)
 {
 	struct lpc_flash *f = (struct lpc_flash *)tf;
+	uint32_t clk_khz = lpc_flash_clk_khz(f);
+	if (!clk_khz)
+		return -2;
+
+	/* Regions sharing iap_ram each keep their own buffer parity, so a
+	 * PROGRAM left running by another region may be reading either
+	 * buffer.  Only one PROGRAM ever runs, so if it isn't ours collect
+	 * it before the upload.
+	 */
+	if (!f->iap_busy && lpc_iap_idle(f->f.t))
+		return -2;
+
+	/* Write payload to target ram.  With room for two staging buffers
+	 * below the IAP stack, this overlaps the PROGRAM of the last one.
+	 */
+	uint32_t bufaddr = lpc_buf_addr(f, f->buf);
+	target_mem_write(f->f.t, bufaddr, src, len);
+	if (f->iap_busy && lpc_iap_finish(f))
+		return -2;
+
 	/* prepare... */
 	uint32_t sector = lpc_sector_for_addr(f, dest);
 	if (lpc_iap_call(f, IAP_CMD_PREPARE, sector, sector, f->bank))
 		return -1;
 
-	/* Write payload to target ram */
-	uint32_t bufaddr = ALIGN(f->iap_ram + sizeof(struct flash_param), 4);
-	target_mem_write(f->f.t, bufaddr, src, len);
-
 	/* set the destination address and program */
-	if (lpc_iap_call(f, IAP_CMD_PROGRAM, dest, bufaddr, len, CPU_CLK_KHZ))
+	lpc_iap_start(f, IAP_CMD_PROGRAM, dest, bufaddr, len, clk_khz);
+	if (lpc_buf_addr(f, 2) <= f->iap_msp - IAP_STACK_SIZE) {
+		f->buf ^= 1;
+		return 0;
+	}
+	if (lpc_iap_finish(f))
+		return -2;
+
+	return 0;
+}
+
+int lpc_flash_done(struct target_flash *tf)
+{
+	struct lpc_flash *f = (struct lpc_flash *)tf;
+
+	if (f->iap_busy && lpc_iap_finish(f))
 		return -2;
 
 	return 0;
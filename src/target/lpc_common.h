@@ -45,9 +45,12 @@ enum iap_status {
 	IAP_STATUS_BUSY = 11,
 };
 
-/* CPU Frequency */
+/* CPU Frequency assumed when it can't be measured (IRC after reset) */
 #define CPU_CLK_KHZ 12000
 
+/* Stack the IAP routines may use below iap_msp */
+#define IAP_STACK_SIZE 128
+
 struct lpc_flash {
 	struct target_flash f;
 	uint8_t base_sector;
@@ -57,13 +60,20 @@ struct lpc_flash {
 	uint32_t iap_entry;
 	uint32_t iap_ram;
 	uint32_t iap_msp;
+	/* Driver state */
+	uint32_t clk_khz;	/* Measured core clock, 0 until measured */
+	uint32_t clk_session;	/* Flash session clk_khz was measured in */
+	uint8_t buf;		/* Staging buffer for the next write */
+	bool iap_busy;		/* PROGRAM still running from the last write */
 };
 
 struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length);
 enum iap_status lpc_iap_call(struct lpc_flash *f, enum iap_cmd cmd, ...);
+uint32_t lpc_flash_clk_khz(struct lpc_flash *f);
 int lpc_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 int lpc_flash_write(struct target_flash *f,
                     target_addr dest, const void *src, size_t len);
+int lpc_flash_done(struct target_flash *f);
 int lpc_flash_write_magic_vect(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
 
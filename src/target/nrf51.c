@@ -25,10 +25,10 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t len);
-static int nrf51_flash_write(struct target_flash *f,
-                             target_addr dest, const void *src, size_t len);
+static int nrf51_flash_mass_erase(struct target_flash *f);
 
 static bool nrf51_cmd_erase_all(target *t);
 static bool nrf51_cmd_read_hwid(target *t);
@@ -94,22 +94,37 @@ const struct command_s nrf51_read_cmd_list[] = {
 #define NRF51_PAGE_SIZE 1024
 #define NRF52_PAGE_SIZE 4096
 
+static const uint16_t nrf51_flash_program[] = {
+#include "flashstub/nrf51.stub"
+};
+
+static const struct flashloader nrf51_flashloader = {
+	.routine = nrf51_flash_program,
+	.routine_size = sizeof(nrf51_flash_program),
+};
+
 static void nrf51_add_flash(target *t,
                             uint32_t addr, size_t length, size_t erasesize)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
-		DEBUG("calloc: failed in %s\n", __func__);
+	struct flashloader_flash *lf =
+		flashloader_add_flash(t, addr, length, erasesize, &nrf51_flashloader);
+	if (!lf)
 		return;
-	}
 
-	f->start = addr;
-	f->length = length;
-	f->blocksize = erasesize;
-	f->erase = nrf51_flash_erase;
-	f->write = nrf51_flash_write;
-	f->erased = 0xff;
-	target_add_flash(t, f);
+	lf->f.erase = nrf51_flash_erase;
+	/* ERASEALL takes the UICR with the code flash */
+	lf->f.mass_erase = nrf51_flash_mass_erase;
+	lf->f.buf_size = erasesize;
+	lf->param = NRF51_NVMC;
+}
+
+/* The loader owns the NVMC while it runs, stop it before erasing */
+static int nrf51_flash_idle(target *t)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		if ((f->erase == nrf51_flash_erase) && flashloader_done(f))
+			return -1;
+	return 0;
 }
 
 bool nrf51_probe(target *t)
@@ -156,6 +171,9 @@ bool nrf51_probe(target *t)
 static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
 	target *t = f->t;
+	if (nrf51_flash_idle(t))
+		return -1;
+
 	/* Enable erase */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
@@ -194,22 +212,28 @@ static int nrf51_flash_erase(struct target_flash *f, target_addr addr, size_t le
 	return 0;
 }
 
-static int nrf51_flash_write(struct target_flash *f,
-                             target_addr dest, const void *src, size_t len)
+static int nrf51_flash_mass_erase(struct target_flash *f)
 {
 	target *t = f->t;
+	if (nrf51_flash_idle(t))
+		return -1;
+
+	/* Enable erase */
+	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
 
-	/* Enable write */
-	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_WEN);
 	/* Poll for NVMC_READY */
 	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
 		if(target_check_error(t))
 			return -1;
-	target_mem_write(t, dest, src, len);
+
+	/* Erase all */
+	target_mem_write32(t, NRF51_NVMC_ERASEALL, 1);
+
 	/* Poll for NVMC_READY */
 	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
 		if(target_check_error(t))
 			return -1;
+
 	/* Return to read-only */
 	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_REN);
 	return 0;
@@ -218,24 +242,7 @@ static int nrf51_flash_write(struct target_flash *f,
 static bool nrf51_cmd_erase_all(target *t)
 {
 	tc_printf(t, "erase..\n");
-
-	/* Enable erase */
-	target_mem_write32(t, NRF51_NVMC_CONFIG, NRF51_NVMC_CONFIG_EEN);
-
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
-			return false;
-
-	/* Erase all */
-	target_mem_write32(t, NRF51_NVMC_ERASEALL, 1);
-
-	/* Poll for NVMC_READY */
-	while (target_mem_read32(t, NRF51_NVMC_READY) == 0)
-		if(target_check_error(t))
-			return false;
-
-	return true;
+	return nrf51_flash_mass_erase(t->flash) == 0;
 }
 
 static bool nrf51_cmd_read_hwid(target *t)
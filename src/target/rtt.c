@@ -0,0 +1,215 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * Copyright (C) 2019  Black Sphere Technologies Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements the probe side of SEGGER's Real Time Transfer.
+ * The target firmware keeps a control block in RAM with up (target to
+ * host) and down (host to target) ring buffers.  While the target runs
+ * the buffer descriptors are polled through the normal memory access
+ * path, and only the read or write offset is written back, so the core
+ * is never halted.  Channel data is passed on through the rtt_if_*
+ * platform functions.
+ */
+
+#include "general.h"
+#include "exception.h"
+#include "target.h"
+#include "target_internal.h"
+#include "rtt.h"
+
+#define RTT_ID		"SEGGER RTT"
+#define RTT_MAX_BUFFERS	16
+
+#if defined(PC_HOSTED)
+#define RTT_SCAN_BLOCK	0x1000
+#define RTT_CHUNK	0x400
+#else
+#define RTT_SCAN_BLOCK	0x100
+#define RTT_CHUNK	0x40
+#endif
+
+/* Control block header and buffer descriptor layout on the target */
+struct rtt_cb {
+	char id[16];
+	uint32_t max_up;
+	uint32_t max_down;
+};
+
+struct rtt_buffer {
+	uint32_t name;
+	uint32_t buf;
+	uint32_t size;
+	uint32_t wroff;
+	uint32_t rdoff;
+	uint32_t flags;
+};
+
+static struct {
+	target *t;
+	target_addr cb;
+	uint32_t num_up;
+	uint32_t num_down;
+	uint32_t up_bytes;
+	uint32_t down_bytes;
+} rtt;
+
+static target_addr rtt_scan(target *t)
+{
+	uint8_t buf[RTT_SCAN_BLOCK + sizeof(RTT_ID)];
+
+	for (struct target_ram *r = t->ram; r; r = r->next) {
+		target_addr end = r->start + r->length;
+		for (target_addr a = r->start; a < end; a += RTT_SCAN_BLOCK) {
+			size_t len = MIN(sizeof(buf), end - a);
+			if (target_mem_read(t, buf, a, len))
+				break;
+			for (size_t i = 0; i + sizeof(RTT_ID) <= len; i += 4)
+				if (!memcmp(buf + i, RTT_ID, sizeof(RTT_ID)))
+					return a + i;
+		}
+	}
+	return 0;
+}
+
+bool rtt_enable(target *t, target_addr cb)
+{
+	struct rtt_cb hdr;
+
+	rtt_disable();
+	if (!cb && !(cb = rtt_scan(t))) {
+		tc_printf(t, "RTT control block not found\n");
+		return false;
+	}
+	if (target_mem_read(t, &hdr, cb, sizeof(hdr)) ||
+	    memcmp(hdr.id, RTT_ID, sizeof(RTT_ID)) ||
+	    (hdr.max_up > RTT_MAX_BUFFERS) || (hdr.max_down > RTT_MAX_BUFFERS)) {
+		tc_printf(t, "No valid RTT control block at 0x%08"PRIx32"\n", cb);
+		return false;
+	}
+
+	rtt.t = t;
+	rtt.cb = cb;
+	rtt.num_up = hdr.max_up;
+	rtt.num_down = hdr.max_down;
+	rtt.up_bytes = rtt.down_bytes = 0;
+	rtt_if_enable(true);
+	return true;
+}
+
+void rtt_disable(void)
+{
+	if (rtt.cb)
+		rtt_if_enable(false);
+	rtt.t = NULL;
+	rtt.cb = 0;
+}
+
+void rtt_status(target *t)
+{
+	if (!rtt.cb || (rtt.t != t)) {
+		tc_printf(t, "RTT disabled\n");
+		return;
+	}
+	tc_printf(t, "RTT control block at 0x%08"PRIx32", %"PRIu32" up and "
+	          "%"PRIu32" down buffers\n", rtt.cb, rtt.num_up, rtt.num_down);
+	tc_printf(t, "%"PRIu32" bytes up, %"PRIu32" bytes down\n",
+	          rtt.up_bytes, rtt.down_bytes);
+}
+
+static bool rtt_poll_up(target *t, unsigned i, struct rtt_buffer *b,
+                        target_addr desc)
+{
+	if ((b->wroff == b->rdoff) ||
+	    (b->wroff >= b->size) || (b->rdoff >= b->size))
+		return false;
+
+	/* Only the contiguous part, the rest comes with the next poll */
+	uint8_t data[RTT_CHUNK];
+	size_t len = (b->wroff > b->rdoff) ? b->wroff - b->rdoff :
+	                                     b->size - b->rdoff;
+	len = MIN(len, sizeof(data));
+	if (target_mem_read(t, data, b->buf + b->rdoff, len))
+		return false;
+
+	int n = rtt_if_write(i, data, len);
+	if (n <= 0)
+		return false;
+	uint32_t rdoff = (b->rdoff + n) % b->size;
+	target_mem_write32(t, desc + offsetof(struct rtt_buffer, rdoff), rdoff);
+	rtt.up_bytes += n;
+	return true;
+}
+
+static bool rtt_poll_down(target *t, unsigned i, struct rtt_buffer *b,
+                          target_addr desc)
+{
+	if ((b->wroff >= b->size) || (b->rdoff >= b->size))
+		return false;
+
+	/* One byte stays free to tell a full buffer from an empty one */
+	size_t space = (b->rdoff > b->wroff) ? b->rdoff - b->wroff - 1 :
+	               b->size - b->wroff - (b->rdoff == 0);
+	uint8_t data[RTT_CHUNK];
+	int n = rtt_if_read(i, data, MIN(space, sizeof(data)));
+	if (n <= 0)
+		return false;
+
+	target_mem_write(t, b->buf + b->wroff, data, n);
+	uint32_t wroff = (b->wroff + n) % b->size;
+	target_mem_write32(t, desc + offsetof(struct rtt_buffer, wroff), wroff);
+	rtt.down_bytes += n;
+	return true;
+}
+
+static bool rtt_poll_buffers(target *t)
+{
+	struct rtt_buffer desc[2 * RTT_MAX_BUFFERS];
+	bool active = false;
+
+	/* All descriptors in one read, they follow the header */
+	target_addr base = rtt.cb + sizeof(struct rtt_cb);
+	size_t n = rtt.num_up + rtt.num_down;
+	if (target_mem_read(t, desc, base, n * sizeof(desc[0])))
+		return false;
+
+	for (unsigned i = 0; i < rtt.num_up; i++)
+		active |= rtt_poll_up(t, i, &desc[i], base + i * sizeof(desc[0]));
+	for (unsigned i = 0; i < rtt.num_down; i++) {
+		unsigned d = rtt.num_up + i;
+		active |= rtt_poll_down(t, i, &desc[d], base + d * sizeof(desc[0]));
+	}
+	return active;
+}
+
+/* Returns true if any channel moved data.  The target keeps running, so
+ * an access can time out if it drops into a low power mode, that only
+ * means there's nothing to move this time round.
+ */
+bool rtt_poll(target *t)
+{
+	volatile bool active = false;
+	volatile struct exception e;
+
+	if (!rtt.cb || (rtt.t != t) || target_sleeping(t))
+		return false;
+
+	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
+		active = rtt_poll_buffers(t);
+	}
+	return !e.type && active;
+}
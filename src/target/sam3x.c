@@ -140,6 +140,7 @@ static void sam3_add_flash(target *t,
 	f->erase = sam3_flash_erase;
 	f->write = sam3x_flash_write;
 	f->buf_size = SAM3_PAGE_SIZE;
+	f->erased = 0xff;
 	sf->eefc_base = eefc_base;
 	sf->write_cmd = EEFC_FCR_FCMD_EWP;
 	target_add_flash(t, f);
@@ -163,6 +164,7 @@ static void sam4_add_flash(target *t,
 	f->erase = sam4_flash_erase;
 	f->write = sam3x_flash_write;
 	f->buf_size = SAM4_PAGE_SIZE;
+	f->erased = 0xff;
 	sf->eefc_base = eefc_base;
 	sf->write_cmd = EEFC_FCR_FCMD_WP;
 	target_add_flash(t, f);
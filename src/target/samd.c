@@ -40,6 +40,8 @@
 static int samd_flash_erase(struct target_flash *t, target_addr addr, size_t len);
 static int samd_flash_write(struct target_flash *f,
                             target_addr dest, const void *src, size_t len);
+static int samd_flash_crc(struct target_flash *f,
+                          target_addr addr, size_t len, uint32_t *crc);
 
 static bool samd_cmd_erase_all(target *t);
 static bool samd_cmd_lock_flash(target *t);
@@ -111,6 +113,7 @@ const struct command_s samd_cmd_list[] = {
 #define SAMD_DSU_CTRLSTAT		(SAMD_DSU_EXT_ACCESS + 0x0)
 #define SAMD_DSU_ADDRESS		(SAMD_DSU_EXT_ACCESS + 0x4)
 #define SAMD_DSU_LENGTH			(SAMD_DSU_EXT_ACCESS + 0x8)
+#define SAMD_DSU_DATA			(SAMD_DSU_EXT_ACCESS + 0xC)
 #define SAMD_DSU_DID			(SAMD_DSU_EXT_ACCESS + 0x018)
 #define SAMD_DSU_PID(n)			(SAMD_DSU + 0x1FE0 + \
 					 (0x4 * (n % 4)) - (0x10 * (n / 4)))
@@ -360,7 +363,9 @@ static void samd_add_flash(target *t, uint32_t addr, size_t length)
 	f->blocksize = SAMD_ROW_SIZE;
 	f->erase = samd_flash_erase;
 	f->write = samd_flash_write;
+	f->crc_ieee = samd_flash_crc;
 	f->buf_size = SAMD_PAGE_SIZE;
+	f->erased = 0xff;
 	target_add_flash(t, f);
 }
 
@@ -728,6 +733,45 @@ static bool samd_cmd_mbist(target *t)
 
 	return true;
 }
+/**
+ * Runs the DSU CRC32 over a flash range, without reading it back. The
+ * DSU computes the reflected IEEE 802.3 CRC, see crc32_ieee_buf().
+ */
+static int samd_flash_crc(struct target_flash *f,
+                          target_addr addr, size_t len, uint32_t *crc)
+{
+	target *t = f->t;
+
+	/* The DSU works on whole words */
+	if ((addr | len) & 3)
+		return -1;
+
+	/* Write the memory parameters to the DSU */
+	target_mem_write32(t, SAMD_DSU_ADDRESS, addr);
+	target_mem_write32(t, SAMD_DSU_LENGTH, len);
+	target_mem_write32(t, SAMD_DSU_DATA, 0xFFFFFFFF);
+
+	/* Clear the status bits */
+	target_mem_write32(t, SAMD_DSU_CTRLSTAT,
+	                   SAMD_STATUSA_DONE | SAMD_STATUSA_BERR);
+
+	/* Write the CRC command */
+	target_mem_write32(t, SAMD_DSU_CTRLSTAT, SAMD_CTRL_CRC);
+
+	/* Poll for DSU Ready */
+	uint32_t status;
+	while (((status = target_mem_read32(t, SAMD_DSU_CTRLSTAT)) &
+		(SAMD_STATUSA_DONE | SAMD_STATUSA_PERR)) == 0)
+		if (target_check_error(t))
+			return -1;
+
+	if (status & (SAMD_STATUSA_BERR | SAMD_STATUSA_PERR))
+		return -1;
+
+	*crc = target_mem_read32(t, SAMD_DSU_DATA);
+	return 0;
+}
+
 /**
  * Sets the security bit
  */
@@ -38,6 +38,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32f1_cmd_erase_mass(target *t);
 static bool stm32f1_cmd_option(target *t, int argc, char *argv[]);
@@ -51,8 +52,6 @@ const struct command_s stm32f1_cmd_list[] = {
 
 static int stm32f1_flash_erase(struct target_flash *f,
                                target_addr addr, size_t len);
-static int stm32f1_flash_write(struct target_flash *f,
-                               target_addr dest, const void *src, size_t len);
 
 /* Flash Program ad Erase Controller Register Map */
 #define FPEC_BASE	0x40022000
@@ -94,28 +93,48 @@ static int stm32f1_flash_write(struct target_flash *f,
 #define FLASHSIZE     0x1FFFF7E0
 #define FLASHSIZE_F0  0x1FFFF7CC
 
+static const uint16_t stm32f1_flash_program[] = {
+#include "flashstub/stm32f1.stub"
+};
+
+static const struct flashloader stm32f1_flashloader = {
+	.routine = stm32f1_flash_program,
+	.routine_size = sizeof(stm32f1_flash_program),
+};
+
 static void stm32f1_add_flash(target *t,
                               uint32_t addr, size_t length, size_t erasesize)
 {
-	struct target_flash *f = calloc(1, sizeof(*f));
-	if (!f) {			/* calloc failed: heap exhaustion */
-		DEBUG("calloc: failed in %s\n", __func__);
+	struct flashloader_flash *lf =
+		flashloader_add_flash(t, addr, length, erasesize, &stm32f1_flashloader);
+	if (!lf)
 		return;
-	}
 
-	f->start = addr;
-	f->length = length;
-	f->blocksize = erasesize;
-	f->erase = stm32f1_flash_erase;
-	f->write = stm32f1_flash_write;
-	f->buf_size = erasesize;
-	f->erased = 0xff;
-	target_add_flash(t, f);
+	lf->f.erase = stm32f1_flash_erase;
+	lf->f.buf_size = erasesize;
+	lf->param = FPEC_BASE;
+}
+
+/* Low density and value line parts share their device ID with parts
+ * of several SRAM sizes, register the smallest one shipped with the
+ * flash size so the loader buffers never run off the end of it.
+ */
+static size_t stm32f1_ld_ram_size(target *t)
+{
+	uint32_t flash_kib = target_mem_read32(t, FLASHSIZE) & 0xffff;
+
+	switch (t->idcode) {
+	case 0x412:  /* F101/F102x4 4k, x6 6k */
+		return (flash_kib <= 16) ? 0x1000 : 0x1800;
+	case 0x420:  /* F100x4/x6 4k, x8/xB 8k */
+		return (flash_kib <= 32) ? 0x1000 : 0x2000;
+	}
+	return 0x5000;
 }
 
 bool stm32f1_probe(target *t)
 {
-	size_t flash_size;
+	size_t flash_size, ram_size;
 	size_t block_size = 0x400;
 	t->idcode = target_mem_read32(t, DBGMCU_IDCODE) & 0xfff;
 	switch(t->idcode) {
@@ -123,7 +142,7 @@ bool stm32f1_probe(target *t)
 	case 0x412:  /* Low denisty */
 	case 0x420:  /* Value Line, Low-/Medium density */
 		t->driver = "STM32F1 medium density";
-		target_add_ram(t, 0x20000000, 0x5000);
+		target_add_ram(t, 0x20000000, stm32f1_ld_ram_size(t));
 		stm32f1_add_flash(t, 0x8000000, 0x20000, 0x400);
 		target_add_commands(t, stm32f1_cmd_list, "STM32 LD/MD");
 		return true;
@@ -154,30 +173,35 @@ bool stm32f1_probe(target *t)
 	case 0x444:  /* STM32F03 RM0091 Rev.7, STM32F030x[4|6] RM0360 Rev. 4*/
 		t->driver = "STM32F03";
 		flash_size = 0x8000;
+		ram_size = 0x1000;
 		break;
 	case 0x445:  /* STM32F04 RM0091 Rev.7, STM32F070x6 RM0360 Rev. 4*/
 		t->driver = "STM32F04/F070x6";
 		flash_size = 0x8000;
+		ram_size = 0x1800;
 		break;
 	case 0x440:  /* STM32F05 RM0091 Rev.7, STM32F030x8 RM0360 Rev. 4*/
 		t->driver = "STM32F05/F030x8";
 		flash_size = 0x10000;
+		ram_size = 0x2000;
 		break;
 	case 0x448:  /* STM32F07 RM0091 Rev.7, STM32F070xB RM0360 Rev. 4*/
 		t->driver = "STM32F07";
 		flash_size = 0x20000;
+		ram_size = 0x4000;
 		block_size = 0x800;
 		break;
 	case 0x442:  /* STM32F09 RM0091 Rev.7, STM32F030xC RM0360 Rev. 4*/
 		t->driver = "STM32F09/F030xC";
 		flash_size = 0x40000;
+		ram_size = 0x8000;
 		block_size = 0x800;
 		break;
 	default:     /* NONE */
 		return false;
 	}
 
-	target_add_ram(t, 0x20000000, 0x5000);
+	target_add_ram(t, 0x20000000, ram_size);
 	stm32f1_add_flash(t, 0x8000000, flash_size, block_size);
 	target_add_commands(t, stm32f1_cmd_list, "STM32F0");
 	return true;
@@ -225,30 +249,6 @@ static int stm32f1_flash_erase(struct target_flash *f,
 	return 0;
 }
 
-static int stm32f1_flash_write(struct target_flash *f,
-                               target_addr dest, const void *src, size_t len)
-{
-	target *t = f->t;
-	uint32_t sr;
-	target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-	cortexm_mem_write_sized(t, dest, src, len, ALIGN_HALFWORD);
-	/* Read FLASH_SR to poll for BSY bit */
-	/* Wait for completion or an error */
-	do {
-		sr = target_mem_read32(t, FLASH_SR);
-		if(target_check_error(t)) {
-			DEBUG("stm32f1 flash write: comm error\n");
-			return -1;
-		}
-	} while (sr & FLASH_SR_BSY);
-
-	if (sr & SR_ERROR_MASK) {
-		DEBUG("stm32f1 flash write error 0x%" PRIx32 "\n", sr);
-			return -1;
-	}
-	return 0;
-}
-
 static bool stm32f1_cmd_erase_mass(target *t)
 {
 	stm32f1_flash_unlock(t);
@@ -55,6 +55,8 @@ static int stm32f4_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len);
 static int stm32f4_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32f4_flash_done(struct target_flash *f);
+static int stm32f4_flash_mass_erase(struct target_flash *f);
 
 /* Flash Program ad Erase Controller Register Map */
 #define FPEC_BASE	0x40023C00
@@ -111,6 +113,8 @@ struct stm32f4_flash {
 	enum align psize;
 	uint8_t base_sector;
 	uint8_t bank_split;
+	uint32_t erase_pending;	/* Blocks queued for erase */
+	bool erasing;			/* A sector erase was started */
 };
 
 enum IDS_STM32F247 {
@@ -148,6 +152,10 @@ static void stm32f4_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32f4_flash_erase;
 	f->write = stm32f4_flash_write;
+	f->done = stm32f4_flash_done;
+	f->mass_erase = stm32f4_flash_mass_erase;
+	/* The ITCM alias is erased as a bank of its own */
+	f->bank = (addr < AXIM_BASE);
 	f->buf_size = 1024;
 	f->erased = 0xff;
 	sf->base_sector = base_sector;
@@ -381,49 +389,114 @@ static void stm32f4_flash_unlock(target *t)
 	}
 }
 
-static int stm32f4_flash_erase(struct target_flash *f, target_addr addr,
-							   size_t len)
+/* Sector erases are queued and started whenever the controller is idle,
+ * so the host can return to GDB and buffer the next vFlashWrite while the
+ * erase runs.  Both banks of dual bank parts share the one controller.
+ * Returns -1 on error, 1 while busy and 0 once the queue is empty.
+ */
+static int stm32f4_flash_pump(target *t)
 {
-	target *t = f->t;
-	struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
-	uint32_t sr;
-	/* No address translation is needed here, as we erase by sector number */
-	uint8_t sector = sf->base_sector + (addr - f->start)/f->blocksize;
-	stm32f4_flash_unlock(t);
-
+	struct stm32f4_flash *next = NULL;
+	bool erasing = false;
 	enum align psize = ALIGN_WORD;
 	for (struct target_flash *f = t->flash; f; f = f->next) {
 		if (f->write == stm32f4_flash_write) {
-			psize = ((struct stm32f4_flash *)f)->psize;
+			struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+			psize = sf->psize;
+			erasing |= sf->erasing;
+			if (!next && sf->erase_pending)
+				next = sf;
 		}
 	}
-	while(len) {
-		uint32_t cr = FLASH_CR_EOPIE | FLASH_CR_ERRIE | FLASH_CR_SER |
-			(psize * FLASH_CR_PSIZE16) | (sector << 3);
-		/* Flash page erase instruction */
-		target_mem_write32(t, FLASH_CR, cr);
-		/* write address to FMA */
-		target_mem_write32(t, FLASH_CR, cr | FLASH_CR_STRT);
-
-		/* Read FLASH_SR to poll for BSY bit */
-		while(target_mem_read32(t, FLASH_SR) & FLASH_SR_BSY)
-			if(target_check_error(t)) {
-				DEBUG("stm32f4 flash erase: comm error\n");
-				return -1;
-			}
-		len -= f->blocksize;
-		sector++;
-		if ((sf->bank_split) && (sector == sf->bank_split))
-			sector = 16;
-	}
+	if (!erasing && !next)
+		return 0;
 
-	/* Check for error */
-	sr = target_mem_read32(t, FLASH_SR);
-	if(sr & SR_ERROR_MASK) {
-		DEBUG("stm32f4 flash erase: sr error: 0x%" PRIu32 "\n", sr);
+	uint32_t sr = target_mem_read32(t, FLASH_SR);
+	if(target_check_error(t)) {
+		DEBUG("stm32f4 flash erase: comm error\n");
 		return -1;
 	}
-	return 0;
+	if (sr & FLASH_SR_BSY)
+		return 1;
+	/* A failed erase abandons the rest of the queue */
+	bool failed = erasing && (sr & SR_ERROR_MASK);
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write == stm32f4_flash_write) {
+			struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+			sf->erasing = false;
+			if (failed)
+				sf->erase_pending = 0;
+		}
+	}
+	if (failed) {
+		DEBUG("stm32f4 flash erase: sr error: 0x%" PRIx32 "\n", sr);
+		return -1;
+	}
+	if (!next || !next->erase_pending)
+		return 0;
+
+	unsigned int block = 0;
+	while (!(next->erase_pending & (1 << block)))
+		block++;
+	next->erase_pending &= ~(1 << block);
+	/* No address translation is needed here, as we erase by sector number */
+	uint8_t sector = next->base_sector + block;
+	if ((next->bank_split) && (next->base_sector < next->bank_split) &&
+	    (sector >= next->bank_split))
+		sector += 16 - next->bank_split;
+	uint32_t cr = FLASH_CR_EOPIE | FLASH_CR_ERRIE | FLASH_CR_SER |
+		(psize * FLASH_CR_PSIZE16) | (sector << 3);
+	/* Flash page erase instruction */
+	target_mem_write32(t, FLASH_CR, cr);
+	/* write address to FMA */
+	target_mem_write32(t, FLASH_CR, cr | FLASH_CR_STRT);
+	next->erasing = true;
+	return 1;
+}
+
+/* Is any erase queued or running? */
+static bool stm32f4_flash_pump_busy(target *t)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write == stm32f4_flash_write) {
+			struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+			if (sf->erasing || sf->erase_pending)
+				return true;
+		}
+	}
+	return false;
+}
+
+/* Wait until all queued erases are done */
+static int stm32f4_flash_wait(target *t)
+{
+	int ret;
+	while ((ret = stm32f4_flash_pump(t)) > 0);
+	return ret;
+}
+
+static int stm32f4_flash_erase(struct target_flash *f, target_addr addr,
+							   size_t len)
+{
+	target *t = f->t;
+	struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+	stm32f4_flash_unlock(t);
+
+	/* Clear errors left by the application or an earlier write, unless
+	 * they belong to an erase that is still queued or running */
+	if (!stm32f4_flash_pump_busy(t))
+		target_mem_write32(t, FLASH_SR, SR_ERROR_MASK);
+
+	unsigned int block = (addr - f->start) / f->blocksize;
+	unsigned int end_block = (addr - f->start + len - 1) / f->blocksize;
+	while (block <= end_block)
+		sf->erase_pending |= 1 << block++;
+	return (stm32f4_flash_pump(t) < 0) ? -1 : 0;
+}
+
+static int stm32f4_flash_done(struct target_flash *f)
+{
+	return stm32f4_flash_wait(f->t);
 }
 
 static int stm32f4_flash_write(struct target_flash *f,
@@ -436,6 +509,8 @@ static int stm32f4_flash_write(struct target_flash *f,
 	target *t = f->t;
 	uint32_t sr;
 	enum align psize = ((struct stm32f4_flash *)f)->psize;
+	if (stm32f4_flash_wait(t))
+		return -1;
 	target_mem_write32(t, FLASH_CR,
 					   (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
 	cortexm_mem_write_sized(t, dest, src, len, psize);
@@ -456,14 +531,12 @@ static int stm32f4_flash_write(struct target_flash *f,
 	return 0;
 }
 
-static bool stm32f4_cmd_erase_mass(target *t)
+static int stm32f4_erase_mass_start(target *t)
 {
-	const char spinner[] = "|/-\\";
-	int spinindex = 0;
-	struct target_flash *f = t->flash;
-	struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
+	struct stm32f4_flash *sf = (struct stm32f4_flash *)t->flash;
 
-	tc_printf(t, "Erasing flash... This may take a few seconds.  ");
+	if (stm32f4_flash_wait(t))
+		return -1;
 	stm32f4_flash_unlock(t);
 
 	/* Flash mass erase start instruction */
@@ -472,6 +545,26 @@ static bool stm32f4_cmd_erase_mass(target *t)
 		cr |=  FLASH_CR_MER1;
 	target_mem_write32(t, FLASH_CR, cr);
 	target_mem_write32(t, FLASH_CR, cr | FLASH_CR_STRT);
+	return 0;
+}
+
+static int stm32f4_erase_mass_check(target *t)
+{
+	/* Check for error */
+	uint32_t sr = target_mem_read32(t, FLASH_SR);
+	if ((sr & SR_ERROR_MASK) || !(sr & SR_EOP))
+		return -1;
+	return 0;
+}
+
+static bool stm32f4_cmd_erase_mass(target *t)
+{
+	const char spinner[] = "|/-\\";
+	int spinindex = 0;
+
+	tc_printf(t, "Erasing flash... This may take a few seconds.  ");
+	if (stm32f4_erase_mass_start(t))
+		return false;
 
 	/* Read FLASH_SR to poll for BSY bit */
 	while (target_mem_read32(t, FLASH_SR) & FLASH_SR_BSY) {
@@ -483,12 +576,19 @@ static bool stm32f4_cmd_erase_mass(target *t)
 	}
 	tc_printf(t, "\n");
 
-	/* Check for error */
-	uint32_t sr = target_mem_read32(t, FLASH_SR);
-	if ((sr & SR_ERROR_MASK) || !(sr & SR_EOP))
-		return false;
+	return stm32f4_erase_mass_check(t) == 0;
+}
 
-	return true;
+static int stm32f4_flash_mass_erase(struct target_flash *f)
+{
+	target *t = f->t;
+
+	if (stm32f4_erase_mass_start(t))
+		return -1;
+	while (target_mem_read32(t, FLASH_SR) & FLASH_SR_BSY)
+		if(target_check_error(t))
+			return -1;
+	return stm32f4_erase_mass_check(t);
 }
 
 /* Dev   | DOC  |Rev|ID |OPTCR    |OPTCR   |OPTCR1   |OPTCR1 | OPTCR2
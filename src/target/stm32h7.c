@@ -29,6 +29,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "crc32.h"
 
 static bool stm32h7_cmd_erase_mass(target *t);
 /* static bool stm32h7_cmd_option(target *t, int argc, char *argv[]); */
@@ -56,6 +57,9 @@ static int stm32h7_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len);
 static int stm32h7_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32h7_flash_done(struct target_flash *f);
+static int stm32h7_flash_crc(struct target_flash *f, target_addr addr,
+                             size_t len, uint32_t *crc);
 
 static const char stm32h74_driver_str[] = "STM32H74x";
 
@@ -71,6 +75,8 @@ enum stm32h7_regs
 	FLASH_OPTSR_CUR = 0x1C,
 	FLASH_OPTSR     = 0x20,
 	FLASH_CRCCR		= 0x50,
+	FLASH_CRCSADDR	= 0x54,
+	FLASH_CRCEADDR	= 0x58,
 	FLASH_CRCDATA	= 0x5C,
 };
 
@@ -120,7 +126,10 @@ enum stm32h7_regs
 #define FLASH_CRCCR_ALL_BANK	(1 <<  7)
 #define FLASH_CRCCR_START_CRC	(1 << 16)
 #define FLASH_CRCCR_CLEAN_CRC	(1 << 17)
+#define FLASH_CRCCR_CRC_BURST_0	(0 << 20)
 #define FLASH_CRCCR_CRC_BURST_3	(3 << 20)
+#define FLASH_CRC_ADDR_MASK		0x000ffffc
+#define FLASH_CRC_BURST_SIZE	128	/* 4 flash words with CRC_BURST_0 */
 
 #define KEY1 0x45670123
 #define KEY2 0xCDEF89AB
@@ -156,6 +165,9 @@ struct stm32h7_flash {
 	struct target_flash f;
 	enum align psize;
 	uint32_t regbase;
+	uint8_t erase_pending;	/* Sectors queued for erase */
+	bool erasing;			/* A sector erase was started */
+	int8_t crc_model;		/* 0 unknown, -1 unusable, else crc_models + 1 */
 };
 
 static void stm32h7_add_flash(target *t,
@@ -175,6 +187,8 @@ static void stm32h7_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32h7_flash_erase;
 	f->write = stm32h7_flash_write;
+	f->done = stm32h7_flash_done;
+	f->crc = stm32h7_flash_crc;
 	f->buf_size = 2048;
 	f->erased = 0xff;
 	sf->regbase = FPEC1_BASE;
@@ -273,45 +287,81 @@ static bool stm32h7_flash_unlock(target *t, uint32_t addr)
 		return true;
 }
 
+/* Each bank has its own controller, so sector erases are queued and
+ * started whenever the bank is idle.  The host returns to GDB while the
+ * erase runs and one bank can be programmed while the other erases.
+ * Returns -1 on error, otherwise the number of banks still busy.
+ */
+static int stm32h7_flash_pump(target *t)
+{
+	int busy = 0;
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write != stm32h7_flash_write)
+			continue;
+		struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+		if (!sf->erasing && !sf->erase_pending)
+			continue;
+		uint32_t sr = target_mem_read32(t, sf->regbase + FLASH_SR);
+		if (target_check_error(t)) {
+			DEBUG("stm32h7_flash_erase: comm failed\n");
+			return -1;
+		}
+		if (sr & (FLASH_SR_QW | FLASH_SR_BSY)) {
+			busy++;
+			continue;
+		}
+		sf->erasing = false;
+		if (sr & FLASH_SR_ERROR_MASK) {
+			DEBUG("stm32h7_flash_erase: error, sr: %08" PRIx32 "\n", sr);
+			sf->erase_pending = 0;
+			return -1;
+		}
+		if (!sf->erase_pending)
+			continue;
+		int sector = 0;
+		while (!(sf->erase_pending & (1 << sector)))
+			sector++;
+		sf->erase_pending &= ~(1 << sector);
+		uint32_t cr = (sf->psize * FLASH_CR_PSIZE16) | FLASH_CR_SER |
+			(sector * FLASH_CR_SNB_1);
+		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
+		cr |= FLASH_CR_START;
+		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
+		DEBUG(" started cr %08" PRIx32 " sector %d\n", cr, sector);
+		sf->erasing = true;
+		busy++;
+	}
+	return busy;
+}
+
+/* Wait for the erases queued on this bank, keeping the other bank going */
+static int stm32h7_flash_wait(struct stm32h7_flash *sf)
+{
+	while (sf->erasing || sf->erase_pending) {
+		if (stm32h7_flash_pump(sf->f.t) < 0)
+			return -1;
+	}
+	return 0;
+}
+
 static int stm32h7_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len)
 {
 	target *t = f->t;
 	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
-	if (stm32h7_flash_unlock(t, addr) == false)
-		return -1;
-	/* We come out of reset with HSI 64 MHz. Adapt FLASH_ACR.*/
-	target_mem_write32(t, sf->regbase + FLASH_ACR, 0);
+	if (!sf->erasing && !sf->erase_pending) {
+		if (stm32h7_flash_unlock(t, addr) == false)
+			return -1;
+		/* We come out of reset with HSI 64 MHz. Adapt FLASH_ACR.*/
+		target_mem_write32(t, sf->regbase + FLASH_ACR, 0);
+	}
 	addr &= (NUM_SECTOR_PER_BANK * FLASH_SECTOR_SIZE) - 1;
 	int start_sector =  addr / FLASH_SECTOR_SIZE;
 	int end_sector   = (addr + len - 1) / FLASH_SECTOR_SIZE;
 
-	enum align psize = ((struct stm32h7_flash *)f)->psize;
-	uint32_t sr;
-	while (start_sector <= end_sector) {
-		uint32_t cr = (psize * FLASH_CR_PSIZE16) | FLASH_CR_SER |
-			(start_sector * FLASH_CR_SNB_1);
-		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
-		cr |= FLASH_CR_START;
-		target_mem_write32(t, sf->regbase + FLASH_CR, cr);
-		DEBUG(" started cr %08" PRIx32 " sr %08" PRIx32 "\n",
-			  target_mem_read32(t, sf->regbase + FLASH_CR),
-			  target_mem_read32(t, sf->regbase + FLASH_SR));
-		do {
-			sr = target_mem_read32(t, sf->regbase + FLASH_SR);
-			if (target_check_error(t)) {
-				DEBUG("stm32h7_flash_erase: comm failed\n");
-				return -1;
-			}
-//			target_mem_write32(t, H7_IWDG_BASE, 0x0000aaaa);
-		}while (sr & (FLASH_SR_QW | FLASH_SR_BSY));
-		if (sr & FLASH_SR_ERROR_MASK) {
-			DEBUG("stm32h7_flash_erase: error, sr: %08" PRIx32 "\n", sr);
-			return -1;
-		}
-		start_sector++;
-	}
-	return 0;
+	while (start_sector <= end_sector)
+		sf->erase_pending |= 1 << start_sector++;
+	return (stm32h7_flash_pump(t) < 0) ? -1 : 0;
 }
 
 static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
@@ -320,6 +370,8 @@ static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
 	target *t = f->t;
 	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
 	enum align psize = sf->psize;
+	if (stm32h7_flash_wait(sf))
+		return -1;
 	if (stm32h7_flash_unlock(t, dest) == false)
 		return -1;
 	uint32_t cr = psize * FLASH_CR_PSIZE16;
@@ -345,6 +397,11 @@ static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
 	return 0;
 }
 
+static int stm32h7_flash_done(struct target_flash *f)
+{
+	return stm32h7_flash_wait((struct stm32h7_flash *)f);
+}
+
 /* Both banks are erased in parallel.*/
 static bool stm32h7_cmd_erase(target *t, int bank_mask)
 {
@@ -360,6 +417,11 @@ static bool stm32h7_cmd_erase(target *t, int bank_mask)
 		}
 	}
 	cr = (psize * FLASH_CR_PSIZE16) | FLASH_CR_BER | FLASH_CR_START;
+	/* Let queued sector erases finish first */
+	int busy;
+	while ((busy = stm32h7_flash_pump(t)) > 0);
+	if (busy < 0)
+		goto done;
 	/* Flash mass erase start instruction */
 	if (do_bank1) {
 		if (stm32h7_flash_unlock(t, BANK1_START) == false) {
@@ -483,6 +545,109 @@ static int stm32h7_crc_bank(target *t, uint32_t bank)
 	return 0;
 }
 
+/* CRC of [addr, addr + len) in address range mode, both burst aligned */
+static int stm32h7_crc_range(struct stm32h7_flash *sf, target_addr addr,
+                             size_t len, uint32_t *crc)
+{
+	target *t = sf->f.t;
+	if (stm32h7_flash_unlock(t, addr) == false)
+		return -1;
+	target_mem_write32(t, sf->regbase + FLASH_CR, FLASH_CR_CRC_EN);
+	uint32_t crccr = FLASH_CRCCR_CRC_BURST_0 | FLASH_CRCCR_CLEAN_CRC;
+	target_mem_write32(t, sf->regbase + FLASH_CRCCR, crccr);
+	target_mem_write32(t, sf->regbase + FLASH_CRCSADDR,
+					   addr & FLASH_CRC_ADDR_MASK);
+	target_mem_write32(t, sf->regbase + FLASH_CRCEADDR,
+					   (addr + len - 4) & FLASH_CRC_ADDR_MASK);
+	target_mem_write32(t, sf->regbase + FLASH_CRCCR,
+					   crccr | FLASH_CRCCR_START_CRC);
+	uint32_t sr;
+	while ((sr = target_mem_read32(t, sf->regbase + FLASH_SR)) &
+		   FLASH_SR_CRC_BUSY) {
+		if (target_check_error(t)) {
+			DEBUG("stm32h7_crc_range: comm failed\n");
+			return -1;
+		}
+		if (sr & FLASH_SR_ERROR_READ) {
+			DEBUG("stm32h7_crc_range: error sr %08" PRIx32 "\n", sr);
+			return -1;
+		}
+	}
+	/* Both banks report through the bank 1 register */
+	*crc = target_mem_read32(t, FPEC1_BASE + FLASH_CRCDATA);
+	target_mem_write32(t, sf->regbase + FLASH_CR, 0);
+	return target_check_error(t) ? -1 : 0;
+}
+
+/* The CRC engine uses the polynomial of GDB's CRC-32.  Which initial
+ * value and final XOR it applies is found by comparing its result for
+ * the start of the bank with one computed on the host.
+ */
+static const uint32_t crc_models[][2] = {
+	/* init,      xorout */
+	{0xffffffff, 0x00000000},
+	{0xffffffff, 0xffffffff},
+	{0x00000000, 0x00000000},
+	{0x00000000, 0xffffffff},
+};
+
+static void stm32h7_crc_calibrate(struct stm32h7_flash *sf)
+{
+	uint8_t data[2 * FLASH_CRC_BURST_SIZE];
+	uint32_t crc;
+	sf->crc_model = -1;
+	if (target_mem_read(sf->f.t, data, sf->f.start, sizeof(data)) ||
+		stm32h7_crc_range(sf, sf->f.start, sizeof(data), &crc))
+		return;
+	uint32_t expect = crc32_buf(data, sizeof(data));
+	for (unsigned i = 0; i < sizeof(crc_models) / sizeof(crc_models[0]); i++) {
+		const uint32_t *m = crc_models[i];
+		if ((crc ^ m[1] ^ crc32_zeros(m[0] ^ 0xffffffff, sizeof(data))) ==
+			expect) {
+			sf->crc_model = i + 1;
+			return;
+		}
+	}
+	DEBUG("stm32h7: flash CRC %08" PRIx32 " does not match %08" PRIx32 "\n",
+		  crc, expect);
+}
+
+/* GDB's CRC-32 of a flash range.  The CRC engine handles the burst
+ * aligned middle, the ends are read back and the results chained.
+ */
+static int stm32h7_flash_crc(struct target_flash *f, target_addr addr,
+                             size_t len, uint32_t *crc)
+{
+	target *t = f->t;
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	target_addr mid = (addr + FLASH_CRC_BURST_SIZE - 1) &
+		~(FLASH_CRC_BURST_SIZE - 1);
+	target_addr end = (addr + len) & ~(FLASH_CRC_BURST_SIZE - 1);
+	if (end <= mid)
+		return -1;
+	if (stm32h7_flash_wait(sf))
+		return -1;
+	if (sf->crc_model == 0)
+		stm32h7_crc_calibrate(sf);
+	if (sf->crc_model < 0)
+		return -1;
+
+	uint8_t bytes[FLASH_CRC_BURST_SIZE];
+	uint32_t head = mid - addr, tail = addr + len - end;
+	uint32_t crc_mid, res;
+	if (head && target_mem_read(t, bytes, addr, head))
+		return -1;
+	res = crc32_update(0xffffffff, bytes, head);
+	if (stm32h7_crc_range(sf, mid, end - mid, &crc_mid))
+		return -1;
+	const uint32_t *m = crc_models[sf->crc_model - 1];
+	res = crc_mid ^ m[1] ^ crc32_zeros(m[0] ^ res, end - mid);
+	if (tail && target_mem_read(t, bytes, end, tail))
+		return -1;
+	*crc = crc32_update(res, bytes, tail);
+	return 0;
+}
+
 static bool stm32h7_crc(target *t)
 {
 	if (stm32h7_crc_bank(t, BANK1_START) ) return false;
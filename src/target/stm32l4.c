@@ -37,6 +37,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32l4_cmd_erase_mass(target *t);
 static bool stm32l4_cmd_erase_bank1(target *t);
@@ -53,8 +54,8 @@ const struct command_s stm32l4_cmd_list[] = {
 
 
 static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t len);
-static int stm32l4_flash_write(struct target_flash *f,
-                               target_addr dest, const void *src, size_t len);
+static bool stm32l4_cmd_erase(target *t, uint32_t action);
+static int stm32l4_flash_mass_erase(struct target_flash *f);
 
 /* Flash Program ad Erase Controller Register Map */
 #define FPEC_BASE			0x40022000
@@ -121,8 +122,11 @@ enum {
 };
 #define FLASH_SIZE_REG  0x1FFF75E0
 
+/* Loader parameter bit: program whole rows in fast mode */
+#define STM32L4_LOADER_FAST	1
+
 struct stm32l4_flash {
-	struct target_flash f;
+	struct flashloader_flash lf;
 	uint32_t bank1_start;
 };
 
@@ -254,28 +258,36 @@ static struct stm32l4_info const * stm32l4_get_chip_info(uint32_t idcode) {
 	return p;
 }
 
+static const uint16_t stm32l4_flash_program[] = {
+#include "flashstub/stm32l4.stub"
+};
+
+static const struct flashloader stm32l4_flashloader = {
+	.routine = stm32l4_flash_program,
+	.routine_size = sizeof(stm32l4_flash_program),
+};
+
 static void stm32l4_add_flash(target *t,
                               uint32_t addr, size_t length, size_t blocksize,
                               uint32_t bank1_start)
 {
 	struct stm32l4_flash *sf = calloc(1, sizeof(*sf));
-	struct target_flash *f;
 
 	if (!sf) {			/* calloc failed: heap exhaustion */
 		DEBUG("calloc: failed in %s\n", __func__);
 		return;
 	}
 
-	f = &sf->f;
-	f->start = addr;
-	f->length = length;
-	f->blocksize = blocksize;
-	f->erase = stm32l4_flash_erase;
-	f->write = stm32l4_flash_write;
-	f->buf_size = 2048;
-	f->erased = 0xff;
+	flashloader_flash_init(t, &sf->lf, addr, length, blocksize,
+	                       &stm32l4_flashloader);
+	sf->lf.f.erase = stm32l4_flash_erase;
+	sf->lf.f.mass_erase = stm32l4_flash_mass_erase;
+	sf->lf.f.bank = (addr >= bank1_start);
+	/* Whole rows of 32 double words, capped for the probe's heap as
+	 * L4R/L4S pages are 8k */
+	sf->lf.f.buf_size = MIN(blocksize, 0x800);
+	sf->lf.param = FPEC_BASE;
 	sf->bank1_start = bank1_start;
-	target_add_flash(t, f);
 }
 
 static bool stm32l4_attach(target *t)
@@ -379,6 +391,11 @@ bool stm32l4_probe(target *t)
 	t->driver = chip->designator;
 	t->attach = stm32l4_attach;
 	t->detach = stm32l4_detach;
+	/* Fast programming needs a mass erased bank, and with differential
+	 * programming GDB's erases only arrive page by page.  Have the erase
+	 * planner mass erase any bank a load erases all of, the
+	 * flash_mass_erase command still overrides this. */
+	target_flash_mass_erase_set(t, 100);
 	target_add_commands(t, stm32l4_cmd_list, chip->designator);
 	return true;
 }
@@ -392,14 +409,30 @@ static void stm32l4_flash_unlock(target *t)
 	}
 }
 
+/* Both banks share FLASH_CR and FLASH_SR, stop every loader before
+ * either is touched */
+static int stm32l4_flash_idle(target *t)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		if ((f->erase == stm32l4_flash_erase) && flashloader_done(f))
+			return -1;
+	return 0;
+}
+
 static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t len)
 {
 	target *t = f->t;
 	uint16_t sr;
-	uint32_t bank1_start = ((struct stm32l4_flash *)f)->bank1_start;
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	uint32_t bank1_start = sf->bank1_start;
 	uint32_t page;
 	uint32_t blocksize = f->blocksize;
 
+	/* Finish programming before changing the mode */
+	if (stm32l4_flash_idle(t))
+		return -1;
+	sf->lf.param = FPEC_BASE;
+
 	stm32l4_flash_unlock(t);
 
 	/* Read FLASH_SR to poll for BSY bit */
@@ -408,6 +441,18 @@ static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t
 			return -1;
 	/* Fixme: OPTVER always set after reset! Wrong option defaults?*/
 	target_mem_write32(t, FLASH_SR, target_mem_read32(t, FLASH_SR));
+
+	/* Fast programming needs the bank mass erased.  Only use it when
+	 * the whole of one bank of a dual bank device is being erased. */
+	if ((bank1_start != (uint32_t)-1) &&
+	    (addr == f->start) && (len >= f->length)) {
+		if (!stm32l4_cmd_erase(t, (addr < bank1_start) ?
+		                       FLASH_CR_MER1 : FLASH_CR_MER2))
+			return -1;
+		sf->lf.param = FPEC_BASE | STM32L4_LOADER_FAST;
+		return 0;
+	}
+
 	page = (addr - 0x08000000) / blocksize;
 	while(len) {
 		uint32_t cr;
@@ -439,29 +484,6 @@ static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t
 	return 0;
 }
 
-static int stm32l4_flash_write(struct target_flash *f,
-                               target_addr dest, const void *src, size_t len)
-{
-	target *t = f->t;
-	target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-	target_mem_write(t, dest, src, len);
-	/* Wait for completion or an error */
-	uint32_t sr;
-	do {
-		sr = target_mem_read32(t, FLASH_SR);
-		if (target_check_error(t)) {
-			DEBUG("stm32l4 flash write: comm error\n");
-			return -1;
-		}
-	} while (sr & FLASH_SR_BSY);
-
-	if(sr & FLASH_SR_ERROR_MASK) {
-		DEBUG("stm32l4 flash write error: sr 0x%" PRIu32 "\n", sr);
-		return -1;
-	}
-	return 0;
-}
-
 static bool stm32l4_cmd_erase(target *t, uint32_t action)
 {
 	stm32l4_flash_unlock(t);
@@ -484,6 +506,27 @@ static bool stm32l4_cmd_erase(target *t, uint32_t action)
 	return true;
 }
 
+static int stm32l4_flash_mass_erase(struct target_flash *f)
+{
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	uint32_t bank1_start = sf->bank1_start;
+	uint32_t action = FLASH_CR_MER1 | FLASH_CR_MER2;
+
+	if (stm32l4_flash_idle(f->t))
+		return -1;
+	sf->lf.param = FPEC_BASE;
+	if (bank1_start != (uint32_t)-1)
+		action = (f->start < bank1_start) ? FLASH_CR_MER1 : FLASH_CR_MER2;
+	target_mem_write32(f->t, FLASH_SR, target_mem_read32(f->t, FLASH_SR));
+	if (!stm32l4_cmd_erase(f->t, action))
+		return -1;
+	/* As in stm32l4_flash_erase(), fast programming once a bank of a
+	 * dual bank device is mass erased */
+	if (bank1_start != (uint32_t)-1)
+		sf->lf.param = FPEC_BASE | STM32L4_LOADER_FAST;
+	return 0;
+}
+
 static bool stm32l4_cmd_erase_mass(target *t)
 {
 	return stm32l4_cmd_erase(t, FLASH_CR_MER1 | FLASH_CR_MER2);
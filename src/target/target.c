@@ -21,6 +21,8 @@
 #include "general.h"
 #include "target.h"
 #include "target_internal.h"
+#include "crc32.h"
+#include "rtt.h"
 
 #include <stdarg.h>
 
@@ -29,6 +31,10 @@ target *target_list = NULL;
 static int target_flash_write_buffered(struct target_flash *f,
                                        target_addr dest, const void *src, size_t len);
 static int target_flash_done_buffered(struct target_flash *f);
+static void flash_buf_free(struct target_flash *f);
+static void breakwatch_cond_free(struct breakwatch *bw);
+static void mem_cache_drop(target *t, bool flash);
+static void mem_cache_drop_range(target *t, target_addr addr, size_t len);
 
 target *target_new(void)
 {
@@ -68,8 +74,9 @@ void target_mem_map_free(target *t)
 	}
 	while (t->flash) {
 		void * next = t->flash->next;
-		if (t->flash->buf)
-			free(t->flash->buf);
+		flash_buf_free(t->flash);
+		free(t->flash->erase_pending);
+		free(t->flash->block_buf);
 		free(t->flash);
 		t->flash = next;
 	}
@@ -79,6 +86,7 @@ void target_list_free(void)
 {
 	struct target_command_s *tc;
 
+	rtt_disable();
 	while(target_list) {
 		target *t = target_list->next;
 		if (target_list->tc)
@@ -91,8 +99,10 @@ void target_list_free(void)
 			target_list->commands = tc;
 		}
 		target_mem_map_free(target_list);
+		free(target_list->mem_cache);
 		while (target_list->bw_list) {
 			void * next = target_list->bw_list->next;
+			breakwatch_cond_free(target_list->bw_list);
 			free(target_list->bw_list);
 			target_list->bw_list = next;
 		}
@@ -137,6 +147,8 @@ target *target_attach(target *t, struct target_controller *tc)
 		t->tc->destroy_callback(t->tc, t);
 
 	t->tc = tc;
+	t->halted = false;
+	mem_cache_drop(t, true);
 
 	if (!t->attach(t))
 		return NULL;
@@ -213,6 +225,267 @@ static struct target_flash *flash_for_addr(target *t, uint32_t addr)
 	return NULL;
 }
 
+/* Differential programming.
+ *
+ * Erases are only recorded, and data for an erase block waiting to be
+ * erased is collected in block_buf.  Once the block is complete its CRC
+ * is compared with the target's (using the flash controller's or the
+ * on-target CRC where there is one) and it is only erased and programmed
+ * if they differ.  Blocks that received no data are erased in
+ * target_flash_done() unless they are blank already.  Flash with erase
+ * blocks too big to buffer, or whose erase blocks aren't a multiple of
+ * the write buffer, is erased eagerly.
+ */
+#if defined(PC_HOSTED)
+# define FLASH_DIFF_MAX_BLOCK	0x20000
+#else
+# define FLASH_DIFF_MAX_BLOCK	0x800
+#endif
+
+static bool flash_diff_usable(struct target_flash *f)
+{
+	return !f->t->flash_diff_off && (f->blocksize <= FLASH_DIFF_MAX_BLOCK) &&
+	       (f->blocksize % f->buf_size == 0);
+}
+
+static size_t flash_block_index(struct target_flash *f, target_addr addr)
+{
+	return (addr - f->start) / f->blocksize;
+}
+
+static bool flash_block_pending(struct target_flash *f, target_addr addr)
+{
+	size_t i = flash_block_index(f, addr);
+	return f->erase_pending && (f->erase_pending[i / 8] & (1 << (i % 8)));
+}
+
+static void flash_block_clear(struct target_flash *f, target_addr addr)
+{
+	size_t i = flash_block_index(f, addr);
+	f->erase_pending[i / 8] &= ~(1 << (i % 8));
+}
+
+static int flash_diff_erase(struct target_flash *f, target_addr addr, size_t len)
+{
+	if (!f->erase_pending) {
+		size_t blocks = (f->length + f->blocksize - 1) / f->blocksize;
+		f->erase_pending = calloc(1, (blocks + 7) / 8);
+		if (!f->erase_pending)
+			return f->erase(f, addr, len);
+		f->block_addr = -1;
+	}
+	for (size_t i = flash_block_index(f, addr);
+	     i <= flash_block_index(f, addr + len - 1); i++)
+		f->erase_pending[i / 8] |= 1 << (i % 8);
+	return 0;
+}
+
+/* Let the driver finish erasing or programming before reading flash back */
+static int flash_diff_settle(struct target_flash *f)
+{
+	if (!f->block_written || !f->done)
+		return 0;
+	f->block_written = false;
+	return f->done(f);
+}
+
+/* Whether the block at addr already holds the data in block_buf */
+static bool flash_diff_same(struct target_flash *f, target_addr addr)
+{
+	uint32_t crc;
+
+	if (f->crc_ieee && (f->crc_ieee(f, addr, f->blocksize, &crc) == 0))
+		return crc == crc32_ieee_buf(f->block_buf, f->blocksize);
+	return target_crc32(f->t, addr, f->blocksize) ==
+	       crc32_buf(f->block_buf, f->blocksize);
+}
+
+/* Erase and program the block in block_buf if the target differs */
+static int flash_diff_flush(struct target_flash *f)
+{
+	target_addr block = f->block_addr;
+	if (block == (target_addr)-1)
+		return 0;
+	f->block_addr = -1;
+	flash_block_clear(f, block);
+
+	if (flash_diff_settle(f))
+		return -1;
+	if (flash_diff_same(f, block))
+		return 0;
+
+	DEBUG("Flash: programming block at 0x%08" PRIx32 "\n", block);
+	int ret = f->erase(f, block, f->blocksize);
+	f->block_written = true;
+	for (size_t i = 0; (ret == 0) && (i < f->blocksize); i += f->buf_size) {
+		/* Nothing to program in a blank buffer.  An erased value of 0
+		 * may just be a driver that never set it, so only trust 0xff. */
+		uint8_t *buf = f->block_buf + i;
+		size_t j;
+		for (j = 0; (j < f->buf_size) && (buf[j] == f->erased); j++);
+		if ((f->erased == 0xff) && (j == f->buf_size))
+			continue;
+		ret = f->write(f, block + i, buf, f->buf_size);
+		f->block_written = true;
+	}
+	return ret;
+}
+
+static int flash_diff_write(struct target_flash *f,
+                            target_addr dest, const uint8_t *src, size_t len)
+{
+	int ret = 0;
+	while (len) {
+		target_addr block = dest - (dest - f->start) % f->blocksize;
+		size_t offset = dest - block;
+		size_t chunk = MIN(f->blocksize - offset, len);
+
+		if (!flash_block_pending(f, block)) {
+			/* Not erased by GDB, program as is */
+			ret |= target_flash_write_buffered(f, dest, src, chunk);
+		} else {
+			if (block != f->block_addr) {
+				ret |= flash_diff_flush(f);
+				if (!f->block_buf)
+					f->block_buf = malloc(f->blocksize);
+				if (!f->block_buf) {	/* malloc failed: heap exhaustion */
+					DEBUG("malloc: failed in %s\n", __func__);
+					return 1;
+				}
+				memset(f->block_buf, f->erased, f->blocksize);
+				f->block_addr = block;
+			}
+			memcpy(f->block_buf + offset, src, chunk);
+		}
+		dest += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+	return ret;
+}
+
+/* Flush the last block and erase the blocks nothing was written to */
+static int flash_diff_done(struct target_flash *f)
+{
+	int ret = flash_diff_flush(f);
+
+	ret |= flash_diff_settle(f);
+	if (!f->block_buf)
+		f->block_buf = malloc(f->blocksize);
+	if (f->block_buf)
+		memset(f->block_buf, f->erased, f->blocksize);
+	for (target_addr block = f->start;
+	     (ret == 0) && (block - f->start < f->length);
+	     block += f->blocksize) {
+		if (!flash_block_pending(f, block))
+			continue;
+		/* Without a buffer to compare against, just erase */
+		if (f->block_buf &&
+		    ((ret = flash_diff_settle(f)) || flash_diff_same(f, block)))
+			continue;
+		ret = f->erase(f, block, f->blocksize);
+		f->block_written = true;
+	}
+
+	free(f->erase_pending);
+	f->erase_pending = NULL;
+	free(f->block_buf);
+	f->block_buf = NULL;
+	return ret;
+}
+
+/* Erase planning.
+ *
+ * With a mass erase policy set, erases of flash that has a mass_erase
+ * hook are recorded like those for differential programming.  Before the
+ * first write, or at done, each bank whose recorded erases cover at least
+ * the policy's share of it is mass erased instead.  Erases left over are
+ * either kept for differential programming or issued block by block.
+ */
+static bool flash_plan_usable(struct target_flash *f)
+{
+	return f->mass_erase && f->t->flash_mass_erase_pct;
+}
+
+static bool flash_same_bank(struct target_flash *a, struct target_flash *b)
+{
+	return (a->mass_erase == b->mass_erase) && (a->bank == b->bank);
+}
+
+static size_t flash_pending_bytes(struct target_flash *f)
+{
+	size_t bytes = 0;
+	for (target_addr block = f->start; block - f->start < f->length;
+	     block += f->blocksize)
+		if (flash_block_pending(f, block))
+			bytes += f->blocksize;
+	return bytes;
+}
+
+/* Erase the recorded blocks, a run of adjacent ones at a time */
+static int flash_plan_erase_pending(struct target_flash *f)
+{
+	int ret = 0;
+	target_addr block = f->start;
+	while ((ret == 0) && (block - f->start < f->length)) {
+		target_addr run = block;
+		while ((block - f->start < f->length) &&
+		       flash_block_pending(f, block))
+			block += f->blocksize;
+		if (block == run) {
+			block += f->blocksize;
+			continue;
+		}
+		ret = f->erase(f, run, block - run);
+		f->block_written = true;
+	}
+	free(f->erase_pending);
+	f->erase_pending = NULL;
+	return ret;
+}
+
+static int flash_plan(target *t)
+{
+	int ret = 0;
+	t->flash_plan_pending = false;
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (!f->erase_pending || !flash_plan_usable(f))
+			continue;
+		/* Each bank is decided at its first flash with erases recorded,
+		 * the flashes before it are still part of the bank's total */
+		struct target_flash *g;
+		for (g = t->flash; (g != f) &&
+		     !(g->erase_pending && flash_same_bank(g, f)); g = g->next);
+		if (g != f)
+			continue;
+
+		uint64_t total = 0, erasing = 0;
+		for (g = t->flash; g; g = g->next) {
+			if (flash_same_bank(g, f)) {
+				total += g->length;
+				erasing += flash_pending_bytes(g);
+			}
+		}
+		if (erasing * 100 < total * t->flash_mass_erase_pct)
+			continue;
+
+		DEBUG("Flash: mass erase of bank at 0x%08" PRIx32 "\n", f->start);
+		mem_cache_drop(t, true);
+		ret |= f->mass_erase(f);
+		for (g = t->flash; g; g = g->next) {
+			if (flash_same_bank(g, f)) {
+				free(g->erase_pending);
+				g->erase_pending = NULL;
+				g->block_written = true;
+			}
+		}
+	}
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		if (f->erase_pending && !flash_diff_usable(f))
+			ret |= flash_plan_erase_pending(f);
+	return ret;
+}
+
 int target_flash_erase(target *t, target_addr addr, size_t len)
 {
 	int ret = 0;
@@ -220,7 +493,14 @@ int target_flash_erase(target *t, target_addr addr, size_t len)
 		struct target_flash *f = flash_for_addr(t, addr);
 		size_t tmptarget = MIN(addr + len, f->start + f->length);
 		size_t tmplen = tmptarget - addr;
-		ret |= f->erase(f, addr, tmplen);
+		mem_cache_drop_range(t, addr, tmplen);
+		if (flash_plan_usable(f)) {
+			ret |= flash_diff_erase(f, addr, tmplen);
+			t->flash_plan_pending = true;
+		} else if (flash_diff_usable(f))
+			ret |= flash_diff_erase(f, addr, tmplen);
+		else
+			ret |= f->erase(f, addr, tmplen);
 		addr += tmplen;
 		len -= tmplen;
 	}
@@ -231,11 +511,17 @@ int target_flash_write(target *t,
                        target_addr dest, const void *src, size_t len)
 {
 	int ret = 0;
+	if (t->flash_plan_pending)
+		ret |= flash_plan(t);
 	while (len) {
 		struct target_flash *f = flash_for_addr(t, dest);
 		size_t tmptarget = MIN(dest + len, f->start + f->length);
 		size_t tmplen = tmptarget - dest;
-		ret |= target_flash_write_buffered(f, dest, src, tmplen);
+		mem_cache_drop_range(t, dest, tmplen);
+		if (f->erase_pending)
+			ret |= flash_diff_write(f, dest, src, tmplen);
+		else
+			ret |= target_flash_write_buffered(f, dest, src, tmplen);
 		dest += tmplen;
 		src += tmplen;
 		len -= tmplen;
@@ -243,9 +529,39 @@ int target_flash_write(target *t,
 	return ret;
 }
 
-int target_flash_done(target *t)
+void target_flash_diff_enable(target *t, bool enable)
 {
+	t->flash_diff_off = !enable;
+}
+
+bool target_flash_diff_enabled(target *t)
+{
+	return !t->flash_diff_off;
+}
+
+void target_flash_mass_erase_set(target *t, unsigned percent)
+{
+	t->flash_mass_erase_pct = MIN(percent, 100);
+}
+
+unsigned target_flash_mass_erase_get(target *t)
+{
+	return t->flash_mass_erase_pct;
+}
+
+static int flash_done(target *t)
+{
+	if (t->flash_plan_pending) {
+		int tmp = flash_plan(t);
+		if (tmp)
+			return tmp;
+	}
 	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->erase_pending) {
+			int tmp = flash_diff_done(f);
+			if (tmp)
+				return tmp;
+		}
 		int tmp = target_flash_done_buffered(f);
 		if (tmp)
 			return tmp;
@@ -258,36 +574,84 @@ int target_flash_done(target *t)
 	return 0;
 }
 
+int target_flash_done(target *t)
+{
+	mem_cache_drop(t, true);
+	int ret = flash_done(t);
+	/* Whatever happened, the next write starts a new session */
+	t->flash_session++;
+	return ret;
+}
+
+/* Buffered writes.
+ *
+ * Writes are collected in blocks of buf_size kept in address order, so
+ * GDB may send them in any order or revisit a block and each block is
+ * still written once, in ascending order, at done.  Past the memory
+ * budget the lowest block is written early to make room.
+ */
+#if defined(PC_HOSTED)
+# define FLASH_BUF_BUDGET	0x100000
+#else
+# define FLASH_BUF_BUDGET	0x800
+#endif
+
+struct target_flash_buf {
+	struct target_flash_buf *next;
+	target_addr addr;
+	uint8_t data[];
+};
+
+/* Where the block at addr is, or would be linked in */
+static struct target_flash_buf **flash_buf_slot(struct target_flash *f,
+                                                target_addr addr)
+{
+	struct target_flash_buf **p = &f->buf;
+	while (*p && ((*p)->addr < addr))
+		p = &(*p)->next;
+	return p;
+}
+
+static int flash_buf_write_first(struct target_flash *f)
+{
+	struct target_flash_buf *b = f->buf;
+	f->buf = b->next;
+	f->buf_count--;
+	int ret = f->write(f, b->addr, b->data, f->buf_size);
+	free(b);
+	return ret;
+}
+
 int target_flash_write_buffered(struct target_flash *f,
                                 target_addr dest, const void *src, size_t len)
 {
 	int ret = 0;
+	size_t max_count = MAX(FLASH_BUF_BUDGET / f->buf_size, 1);
 
-	if (f->buf == NULL) {
-		/* Allocate flash sector buffer */
-		f->buf = malloc(f->buf_size);
-		if (!f->buf) {			/* malloc failed: heap exhaustion */
-			DEBUG("malloc: failed in %s\n", __func__);
-			return 1;
-		}
-		f->buf_addr = -1;
-	}
 	while (len) {
 		uint32_t offset = dest % f->buf_size;
 		uint32_t base = dest - offset;
-		if (base != f->buf_addr) {
-			if (f->buf_addr != (uint32_t)-1) {
-				/* Write sector to flash if valid */
-				ret |= f->write(f, f->buf_addr,
-				                f->buf, f->buf_size);
+		struct target_flash_buf **p = flash_buf_slot(f, base);
+		if (!*p || ((*p)->addr != base)) {
+			if (f->buf_count >= max_count) {
+				ret |= flash_buf_write_first(f);
+				p = flash_buf_slot(f, base);
 			}
-			/* Setup buffer for a new sector */
-			f->buf_addr = base;
-			memset(f->buf, f->erased, f->buf_size);
+			/* Setup buffer for a new block */
+			struct target_flash_buf *b = malloc(sizeof(*b) + f->buf_size);
+			if (!b) {			/* malloc failed: heap exhaustion */
+				DEBUG("malloc: failed in %s\n", __func__);
+				return 1;
+			}
+			b->addr = base;
+			memset(b->data, f->erased, f->buf_size);
+			b->next = *p;
+			*p = b;
+			f->buf_count++;
 		}
-		/* Copy chunk into sector buffer */
+		/* Copy chunk into block buffer */
 		size_t sectlen = MIN(f->buf_size - offset, len);
-		memcpy(f->buf + offset, src, sectlen);
+		memcpy((*p)->data + offset, src, sectlen);
 		dest += sectlen;
 		src += sectlen;
 		len -= sectlen;
@@ -295,17 +659,21 @@ int target_flash_write_buffered(struct target_flash *f,
 	return ret;
 }
 
-int target_flash_done_buffered(struct target_flash *f)
+static void flash_buf_free(struct target_flash *f)
 {
-	int ret = 0;
-	if ((f->buf != NULL) &&(f->buf_addr != (uint32_t)-1)) {
-		/* Write sector to flash if valid */
-		ret = f->write(f, f->buf_addr, f->buf, f->buf_size);
-		f->buf_addr = -1;
-		free(f->buf);
-		f->buf = NULL;
+	while (f->buf) {
+		struct target_flash_buf *b = f->buf;
+		f->buf = b->next;
+		free(b);
 	}
+	f->buf_count = 0;
+}
 
+int target_flash_done_buffered(struct target_flash *f)
+{
+	int ret = 0;
+	while (f->buf)
+		ret |= flash_buf_write_first(f);
 	return ret;
 }
 
@@ -314,6 +682,8 @@ void target_detach(target *t)
 {
 	t->detach(t);
 	t->attached = false;
+	t->halted = false;
+	mem_cache_drop(t, true);
 #if defined(PC_HOSTED)
 # include "platform.h"
 	platform_buffer_flush();
@@ -323,34 +693,300 @@ void target_detach(target *t)
 bool target_check_error(target *t) { return t->check_error(t); }
 bool target_attached(target *t) { return t->attached; }
 
+/* Check that [addr, addr + len) lies within a single RAM region */
+static bool ram_range_mapped(target *t, target_addr addr, size_t len)
+{
+	for (struct target_ram *r = t->ram; r; r = r->next)
+		if ((r->start <= addr) && (len <= r->length) &&
+		    (addr - r->start <= r->length - len))
+			return true;
+	return false;
+}
+
+/* Check that [addr, addr + len) lies within a single Flash region */
+static bool flash_range_mapped(target *t, target_addr addr, size_t len)
+{
+	struct target_flash *f = flash_for_addr(t, addr);
+	return f && (len <= f->length) && (addr - f->start <= f->length - len);
+}
+
+static bool mem_range_mapped(target *t, target_addr addr, size_t len)
+{
+	return ram_range_mapped(t, addr, len) || flash_range_mapped(t, addr, len);
+}
+
+/* Read cache between target_mem_read() and t->mem_read.
+ *
+ * Whole pages are fetched, but only from the RAM and Flash regions in
+ * the memory map so peripheral and device memory is never cached.  Some
+ * drivers map RAM with a broad brush (lpc43xx up to 0xffffffff), so the
+ * peripheral and device ranges of the default map are never cached
+ * whatever the memory map says.  RAM pages are only valid while the
+ * target stays halted.  Flash pages are kept across a resume until the
+ * flash functions write or erase them.
+ * Larger reads (memory dumps, verify) bypass the cache.
+ */
+#if defined(PC_HOSTED)
+# define MEM_CACHE_PAGE_SIZE	0x100
+# define MEM_CACHE_PAGES	32
+#else
+# define MEM_CACHE_PAGE_SIZE	0x40
+# define MEM_CACHE_PAGES	8
+#endif
+#define MEM_CACHE_MAX_READ	0x40
+
+struct target_mem_cache {
+	struct mem_cache_page {
+		target_addr addr;
+		uint32_t used; /* LRU stamp, zero if the page is invalid */
+		bool flash;
+		uint8_t data[MEM_CACHE_PAGE_SIZE];
+	} page[MEM_CACHE_PAGES];
+	uint32_t stamp;
+	uint32_t hits;
+	uint32_t misses;
+};
+
+/* Drop the RAM pages, and the Flash pages too if flash is set */
+static void mem_cache_drop(target *t, bool flash)
+{
+	if (!t->mem_cache)
+		return;
+	for (int i = 0; i < MEM_CACHE_PAGES; i++) {
+		struct mem_cache_page *p = &t->mem_cache->page[i];
+		if (flash || !p->flash)
+			p->used = 0;
+	}
+}
+
+/* Drop all pages overlapping [addr, addr + len) */
+static void mem_cache_drop_range(target *t, target_addr addr, size_t len)
+{
+	if (!t->mem_cache)
+		return;
+	for (int i = 0; i < MEM_CACHE_PAGES; i++) {
+		struct mem_cache_page *p = &t->mem_cache->page[i];
+		if ((p->addr < addr + len) && (addr < p->addr + MEM_CACHE_PAGE_SIZE))
+			p->used = 0;
+	}
+}
+
+/* Copy data written to RAM into any cached pages it overlaps */
+static void mem_cache_update(target *t, target_addr addr,
+                             const uint8_t *src, size_t len)
+{
+	if (!t->mem_cache)
+		return;
+	for (int i = 0; i < MEM_CACHE_PAGES; i++) {
+		struct mem_cache_page *p = &t->mem_cache->page[i];
+		if (!p->used || (p->addr >= addr + len) ||
+		    (addr >= p->addr + MEM_CACHE_PAGE_SIZE))
+			continue;
+		if (p->flash) {
+			/* A plain write doesn't program flash */
+			p->used = 0;
+			continue;
+		}
+		target_addr start = MAX(addr, p->addr);
+		target_addr end = MIN(addr + len, p->addr + MEM_CACHE_PAGE_SIZE);
+		memcpy(&p->data[start - p->addr], &src[start - addr], end - start);
+	}
+}
+
+/* Peripheral, external device and system space in the default map */
+static bool mem_cache_device(target_addr base)
+{
+	return ((base >= 0x40000000) && (base < 0x60000000)) ||
+	       (base >= 0xa0000000);
+}
+
+/* Find the page at base, filling it on a miss if it may be cached */
+static struct mem_cache_page *mem_cache_page(target *t, target_addr base)
+{
+	struct target_mem_cache *c = t->mem_cache;
+	struct mem_cache_page *victim = &c->page[0];
+
+	for (int i = 0; i < MEM_CACHE_PAGES; i++) {
+		struct mem_cache_page *p = &c->page[i];
+		if (p->used && (p->addr == base)) {
+			p->used = ++c->stamp;
+			c->hits++;
+			return p;
+		}
+		if (p->used < victim->used)
+			victim = p;
+	}
+
+	if (mem_cache_device(base))
+		return NULL;
+	bool flash = flash_range_mapped(t, base, MEM_CACHE_PAGE_SIZE);
+	if (!flash && !(t->halted &&
+	                ram_range_mapped(t, base, MEM_CACHE_PAGE_SIZE)))
+		return NULL;
+
+	c->misses++;
+	victim->used = 0;
+	t->mem_read(t, victim->data, base, MEM_CACHE_PAGE_SIZE);
+	if (target_check_error(t))
+		return NULL;
+	victim->addr = base;
+	victim->flash = flash;
+	victim->used = ++c->stamp;
+	return victim;
+}
+
+void target_mem_cache_enable(target *t, bool enable)
+{
+	t->mem_cache_off = !enable;
+	if (t->mem_cache_off) {
+		free(t->mem_cache);
+		t->mem_cache = NULL;
+	}
+}
+
+void target_mem_cache_info(target *t)
+{
+	struct target_mem_cache *c = t->mem_cache;
+	tc_printf(t, "Memory read cache: %s, %d pages of %d bytes\n",
+	          t->mem_cache_off ? "disabled" : "enabled",
+	          MEM_CACHE_PAGES, MEM_CACHE_PAGE_SIZE);
+	if (c)
+		tc_printf(t, "Hits %" PRIu32 " misses %" PRIu32 "\n",
+		          c->hits, c->misses);
+}
+
 /* Memory access functions */
 int target_mem_read(target *t, void *dest, target_addr src, size_t len)
 {
-	t->mem_read(t, dest, src, len);
-	return target_check_error(t);
+	if (!t->mem_cache_off && !t->mem_cache && (len <= MEM_CACHE_MAX_READ))
+		t->mem_cache = calloc(1, sizeof(*t->mem_cache));
+
+	if (!t->mem_cache || (len > MEM_CACHE_MAX_READ)) {
+		t->mem_read(t, dest, src, len);
+		return target_check_error(t);
+	}
+
+	uint8_t *d = dest;
+	while (len) {
+		target_addr base = src & ~(MEM_CACHE_PAGE_SIZE - 1);
+		size_t offset = src - base;
+		size_t chunk = MIN(MEM_CACHE_PAGE_SIZE - offset, len);
+		struct mem_cache_page *p = mem_cache_page(t, base);
+		if (p) {
+			memcpy(d, &p->data[offset], chunk);
+		} else {
+			t->mem_read(t, d, src, chunk);
+			if (target_check_error(t))
+				return 1;
+		}
+		d += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+	return 0;
 }
 
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len)
 {
 	t->mem_write(t, dest, src, len);
-	return target_check_error(t);
+	if (target_check_error(t)) {
+		mem_cache_drop_range(t, dest, len);
+		return 1;
+	}
+	mem_cache_update(t, dest, src, len);
+	return 0;
+}
+
+uint32_t target_crc32(target *t, target_addr addr, size_t len)
+{
+	uint32_t crc;
+
+	/* Prefer the flash controller's own checksum over reading flash */
+	struct target_flash *f = flash_for_addr(t, addr);
+	if (f && f->crc && (addr + len <= f->start + f->length) &&
+	    (f->crc(f, addr, len, &crc) == 0))
+		return crc;
+
+	/* Only offload ranges the target is known to be able to read */
+	if (t->crc32 && mem_range_mapped(t, addr, len) &&
+	    (t->crc32(t, addr, len, &crc) == 0))
+		return crc;
+
+	return generic_crc32(t, addr, len);
 }
 
 /* Register access functions */
 void target_regs_read(target *t, void *data) { t->regs_read(t, data); }
 void target_regs_write(target *t, const void *data) { t->regs_write(t, data); }
 
+/* Read a single register, numbered as in the 'g' packet */
+ssize_t target_reg_read(target *t, int reg, void *data, size_t max)
+{
+	if (t->reg_read)
+		return t->reg_read(t, reg, data, max);
+
+	/* Fall back to picking a word out of the full register set */
+	if ((reg < 0) || ((reg + 1) * 4 > (int)t->regs_size) || (max < 4))
+		return -1;
+	uint32_t regs[t->regs_size / 4];
+	t->regs_read(t, regs);
+	memcpy(data, &regs[reg], 4);
+	return 4;
+}
+
 /* Halt/resume functions */
-void target_reset(target *t) { t->reset(t); }
+void target_reset(target *t)
+{
+	mem_cache_drop(t, true);
+	t->reset(t);
+}
+
 void target_halt_request(target *t) { t->halt_request(t); }
+
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch)
 {
-	return t->halt_poll(t, watch);
+	enum target_halt_reason reason = t->halt_poll(t, watch);
+	if (reason == TARGET_HALT_ERROR)
+		return reason; /* the target list may be gone */
+
+	bool halted = (reason != TARGET_HALT_RUNNING);
+	if (!halted && t->halted)
+		mem_cache_drop(t, false); /* resumed behind our back */
+	t->halted = halted;
+	return reason;
 }
 
-void target_halt_resume(target *t, bool step) { t->halt_resume(t, step); }
+void target_halt_resume(target *t, bool step)
+{
+	t->halted = false;
+	mem_cache_drop(t, false);
+	t->halt_resume(t, step);
+}
+
+bool target_sleeping(target *t) { return t->sleeping; }
 
 /* Break-/watchpoint functions */
+static struct breakwatch *breakwatch_find(target *t,
+                                          enum target_breakwatch type, target_addr addr, size_t len)
+{
+	struct breakwatch *bw;
+	for (bw = t->bw_list; bw; bw = bw->next)
+		if ((bw->type == type) &&
+		    (bw->addr == addr) &&
+		    (bw->size == len))
+			break;
+	return bw;
+}
+
+static void breakwatch_cond_free(struct breakwatch *bw)
+{
+	while (bw->cond) {
+		struct breakwatch_cond *next = bw->cond->next;
+		free(bw->cond);
+		bw->cond = next;
+	}
+}
+
 int target_breakwatch_set(target *t,
                           enum target_breakwatch type, target_addr addr, size_t len)
 {
@@ -361,12 +997,20 @@ int target_breakwatch_set(target *t,
 	};
 	int ret = 1;
 
+	/* GDB sends Z again for an inserted breakpoint to replace its
+	 * conditions, don't take another hardware unit for it. */
+	struct breakwatch *bwm = breakwatch_find(t, type, addr, len);
+	if (bwm) {
+		breakwatch_cond_free(bwm);
+		return 0;
+	}
+
 	if (t->breakwatch_set)
 		ret = t->breakwatch_set(t, &bw);
 
 	if (ret == 0) {
 		/* Success, make a heap copy */
-		struct breakwatch *bwm = malloc(sizeof bw);
+		bwm = malloc(sizeof bw);
 		if (!bwm) {			/* malloc failed: heap exhaustion */
 			DEBUG("malloc: failed in %s\n", __func__);
 			return 1;
@@ -404,11 +1048,267 @@ int target_breakwatch_clear(target *t,
 		} else {
 			bwp->next = bw->next;
 		}
+		breakwatch_cond_free(bw);
 		free(bw);
 	}
 	return ret;
 }
 
+/* Attach a condition to an inserted break-/watchpoint.  Conditions are
+ * GDB agent expressions, the stop is reported if any of them is true. */
+int target_breakwatch_cond(target *t,
+                           enum target_breakwatch type, target_addr addr, size_t len,
+                           const uint8_t *bytecode, size_t bclen)
+{
+	struct breakwatch *bw = breakwatch_find(t, type, addr, len);
+	if (bw == NULL)
+		return -1;
+
+	struct breakwatch_cond *c = malloc(sizeof(*c) + bclen);
+	if (!c) {			/* malloc failed: heap exhaustion */
+		DEBUG("malloc: failed in %s\n", __func__);
+		return -1;
+	}
+	c->len = bclen;
+	memcpy(c->bytecode, bytecode, bclen);
+	c->next = bw->cond;
+	bw->cond = c;
+	return 0;
+}
+
+int target_breakwatch_ignore(target *t, target_addr addr, uint32_t count)
+{
+	int ret = -1;
+	for (struct breakwatch *bw = t->bw_list; bw; bw = bw->next) {
+		if ((bw->addr != addr) ||
+		    ((bw->type != TARGET_BREAK_SOFT) && (bw->type != TARGET_BREAK_HARD)))
+			continue;
+		bw->ignore = count;
+		ret = 0;
+	}
+	return ret;
+}
+
+void target_breakwatch_info(target *t)
+{
+	static const char *const types[] = {
+		[TARGET_BREAK_SOFT] = "break", [TARGET_BREAK_HARD] = "hbreak",
+		[TARGET_WATCH_WRITE] = "watch", [TARGET_WATCH_READ] = "rwatch",
+		[TARGET_WATCH_ACCESS] = "awatch",
+	};
+	for (struct breakwatch *bw = t->bw_list; bw; bw = bw->next)
+		tc_printf(t, "%-6s 0x%08" PRIx32 "%s hits %" PRIu32 " ignore %" PRIu32 "\n",
+		          types[bw->type], bw->addr, bw->cond ? " (cond)" : "",
+		          bw->hits, bw->ignore);
+}
+
+/* GDB agent expression opcodes, see gdb/common/ax.def */
+enum ax_op {
+	AX_ADD = 0x02, AX_SUB, AX_MUL, AX_DIV_SIGNED, AX_DIV_UNSIGNED,
+	AX_REM_SIGNED, AX_REM_UNSIGNED, AX_LSH, AX_RSH_SIGNED, AX_RSH_UNSIGNED,
+	AX_LOG_NOT = 0x0e, AX_BIT_AND, AX_BIT_OR, AX_BIT_XOR, AX_BIT_NOT,
+	AX_EQUAL, AX_LESS_SIGNED, AX_LESS_UNSIGNED, AX_EXT,
+	AX_REF8, AX_REF16, AX_REF32, AX_REF64,
+	AX_IF_GOTO = 0x20, AX_GOTO, AX_CONST8, AX_CONST16, AX_CONST32, AX_CONST64,
+	AX_REG, AX_END, AX_DUP, AX_POP, AX_ZERO_EXT, AX_SWAP,
+	AX_PICK = 0x32, AX_ROT,
+};
+
+#define AX_STACK_DEPTH 16
+
+static uint64_t ax_operand(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+	while (n--)
+		v = (v << 8) | *p++;
+	return v;
+}
+
+/* Evaluate agent expression bytecode.  Returns false if the expression
+ * can't be evaluated here, the caller should then report the stop. */
+static bool ax_eval(target *t, const uint8_t *ax, size_t len, int64_t *result)
+{
+	int64_t stack[AX_STACK_DEPTH];
+	int sp = 0;
+	size_t pc = 0;
+	unsigned budget = 1024; /* guard against backward jumps looping */
+
+#define AX_NEED(pop, push) do { \
+	if ((sp < (pop)) || (sp - (pop) + (push) > AX_STACK_DEPTH)) return false; \
+} while (0)
+#define AX_ARGS(n) do { if (pc + (n) > len) return false; } while (0)
+
+	while ((pc < len) && budget--) {
+		uint8_t op = ax[pc++];
+		int64_t a, b;
+		uint64_t v = 0;
+		int n;
+
+		switch (op) {
+		case AX_ADD ... AX_RSH_UNSIGNED:
+		case AX_BIT_AND ... AX_BIT_XOR:
+		case AX_EQUAL ... AX_LESS_UNSIGNED:
+			AX_NEED(2, 1);
+			b = stack[--sp];
+			a = stack[sp - 1];
+			switch (op) {
+			case AX_ADD: a += b; break;
+			case AX_SUB: a -= b; break;
+			case AX_MUL: a *= b; break;
+			case AX_DIV_SIGNED:
+				if (b == 0) return false;
+				a /= b; break;
+			case AX_DIV_UNSIGNED:
+				if (b == 0) return false;
+				a = (uint64_t)a / (uint64_t)b; break;
+			case AX_REM_SIGNED:
+				if (b == 0) return false;
+				a %= b; break;
+			case AX_REM_UNSIGNED:
+				if (b == 0) return false;
+				a = (uint64_t)a % (uint64_t)b; break;
+			case AX_LSH: a = (uint64_t)a << (b & 63); break;
+			case AX_RSH_SIGNED: a >>= (b & 63); break;
+			case AX_RSH_UNSIGNED: a = (uint64_t)a >> (b & 63); break;
+			case AX_BIT_AND: a &= b; break;
+			case AX_BIT_OR: a |= b; break;
+			case AX_BIT_XOR: a ^= b; break;
+			case AX_EQUAL: a = (a == b); break;
+			case AX_LESS_SIGNED: a = (a < b); break;
+			case AX_LESS_UNSIGNED: a = ((uint64_t)a < (uint64_t)b); break;
+			}
+			stack[sp - 1] = a;
+			break;
+		case AX_LOG_NOT:
+			AX_NEED(1, 1);
+			stack[sp - 1] = !stack[sp - 1];
+			break;
+		case AX_BIT_NOT:
+			AX_NEED(1, 1);
+			stack[sp - 1] = ~stack[sp - 1];
+			break;
+		case AX_EXT:
+		case AX_ZERO_EXT:
+			AX_ARGS(1);
+			AX_NEED(1, 1);
+			n = ax[pc++];
+			if (n < 64) {
+				v = (uint64_t)stack[sp - 1] & ((1ULL << n) - 1);
+				if ((op == AX_EXT) && n && (v & (1ULL << (n - 1))))
+					v |= ~((1ULL << n) - 1);
+				stack[sp - 1] = v;
+			}
+			break;
+		case AX_REF8 ... AX_REF64:
+			AX_NEED(1, 1);
+			n = 1 << (op - AX_REF8);
+			if (target_mem_read(t, &v, stack[sp - 1], n))
+				return false;
+			stack[sp - 1] = v;
+			break;
+		case AX_IF_GOTO:
+		case AX_GOTO:
+			AX_ARGS(2);
+			v = ax_operand(&ax[pc], 2);
+			pc += 2;
+			if (op == AX_IF_GOTO) {
+				AX_NEED(1, 0);
+				if (!stack[--sp])
+					break;
+			}
+			pc = v;
+			break;
+		case AX_CONST8 ... AX_CONST64:
+			n = 1 << (op - AX_CONST8);
+			AX_ARGS(n);
+			AX_NEED(0, 1);
+			stack[sp++] = ax_operand(&ax[pc], n);
+			pc += n;
+			break;
+		case AX_REG:
+			AX_ARGS(2);
+			AX_NEED(0, 1);
+			if (target_reg_read(t, ax_operand(&ax[pc], 2), &v, sizeof(v)) < 0)
+				return false;
+			pc += 2;
+			stack[sp++] = v;
+			break;
+		case AX_END:
+			AX_NEED(1, 0);
+			*result = stack[sp - 1];
+			return true;
+		case AX_DUP:
+			AX_NEED(1, 2);
+			stack[sp] = stack[sp - 1];
+			sp++;
+			break;
+		case AX_POP:
+			AX_NEED(1, 0);
+			sp--;
+			break;
+		case AX_SWAP:
+			AX_NEED(2, 2);
+			a = stack[sp - 1];
+			stack[sp - 1] = stack[sp - 2];
+			stack[sp - 2] = a;
+			break;
+		case AX_PICK:
+			AX_ARGS(1);
+			n = ax[pc++];
+			AX_NEED(n + 1, n + 2);
+			stack[sp] = stack[sp - 1 - n];
+			sp++;
+			break;
+		case AX_ROT:
+			AX_NEED(3, 3);
+			a = stack[sp - 1];
+			stack[sp - 1] = stack[sp - 2];
+			stack[sp - 2] = stack[sp - 3];
+			stack[sp - 3] = a;
+			break;
+		default:
+			/* Tracing, floating point and printf aren't supported */
+			return false;
+		}
+	}
+#undef AX_NEED
+#undef AX_ARGS
+	return false;
+}
+
+/* Called by the target driver when it halts on a breakpoint at addr.
+ * Returns false if the stop should be hidden from GDB and the target
+ * resumed, because no condition holds or the ignore count is not used up.
+ */
+bool target_breakwatch_check(target *t, target_addr addr)
+{
+	bool found = false, report = false;
+
+	for (struct breakwatch *bw = t->bw_list; bw; bw = bw->next) {
+		if ((bw->addr != addr) ||
+		    ((bw->type != TARGET_BREAK_SOFT) && (bw->type != TARGET_BREAK_HARD)))
+			continue;
+		found = true;
+
+		bool hit = (bw->cond == NULL);
+		for (struct breakwatch_cond *c = bw->cond; c && !hit; c = c->next) {
+			int64_t val;
+			/* Let GDB decide if we can't evaluate the condition */
+			hit = !ax_eval(t, c->bytecode, c->len, &val) || val;
+		}
+		if (!hit)
+			continue;
+
+		bw->hits++;
+		if (bw->ignore) {
+			bw->ignore--;
+			continue;
+		}
+		report = true;
+	}
+	return report || !found;
+}
+
 /* Accessor functions */
 size_t target_regs_size(target *t)
 {
@@ -439,6 +1339,7 @@ uint32_t target_mem_read32(target *t, uint32_t addr)
 
 void target_mem_write32(target *t, uint32_t addr, uint32_t value)
 {
+	mem_cache_drop_range(t, addr, sizeof(value));
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -451,6 +1352,7 @@ uint16_t target_mem_read16(target *t, uint32_t addr)
 
 void target_mem_write16(target *t, uint32_t addr, uint16_t value)
 {
+	mem_cache_drop_range(t, addr, sizeof(value));
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -463,6 +1365,7 @@ uint8_t target_mem_read8(target *t, uint32_t addr)
 
 void target_mem_write8(target *t, uint32_t addr, uint8_t value)
 {
+	mem_cache_drop_range(t, addr, sizeof(value));
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -477,6 +1380,8 @@ void target_command_help(target *t)
 
 int target_command(target *t, int argc, const char *argv[])
 {
+	/* Driver commands may erase or reprogram anything */
+	mem_cache_drop(t, true);
 	for (struct target_command_s *tc = t->commands; tc; tc = tc->next)
 		for(const struct command_s *c = tc->cmds; c->cmd; c++)
 			if(!strncmp(argv[0], c->cmd, strlen(argv[0])))
@@ -35,6 +35,9 @@ typedef int (*flash_erase_func)(struct target_flash *f, target_addr addr, size_t
 typedef int (*flash_write_func)(struct target_flash *f, target_addr dest,
                                 const void *src, size_t len);
 typedef int (*flash_done_func)(struct target_flash *f);
+typedef int (*flash_mass_erase_func)(struct target_flash *f);
+typedef int (*flash_crc_func)(struct target_flash *f, target_addr addr,
+                              size_t len, uint32_t *crc);
 struct target_flash {
 	target_addr start;
 	size_t length;
@@ -42,12 +45,24 @@ struct target_flash {
 	flash_erase_func erase;
 	flash_write_func write;
 	flash_done_func done;
+	flash_crc_func crc;	/* Optional, GDB's CRC-32 computed by the target */
+	flash_crc_func crc_ieee;	/* Optional, see crc32_ieee_buf() */
+	/* Optional, erases all flash with the same mass_erase and bank */
+	flash_mass_erase_func mass_erase;
+	uint8_t bank;
 	target *t;
 	uint8_t erased;
 	size_t buf_size;
 	struct target_flash *next;
-	target_addr buf_addr;
-	void *buf;
+	/* Blocks of buf_size waiting to be written, in address order */
+	struct target_flash_buf *buf;
+	size_t buf_count;
+	/* Differential programming: erase blocks waiting for a lazy erase,
+	 * and the data for the one currently being received */
+	uint8_t *erase_pending;
+	uint8_t *block_buf;
+	target_addr block_addr;
+	bool block_written; /* f->erase or f->write used since f->done */
 };
 
 typedef bool (*cmd_handler)(target *t, int argc, const char **argv);
@@ -64,11 +79,21 @@ struct target_command_s {
 	struct target_command_s *next;
 };
 
+/* Agent expression bytecode sent by GDB as a breakpoint condition */
+struct breakwatch_cond {
+	struct breakwatch_cond *next;
+	size_t len;
+	uint8_t bytecode[];
+};
+
 struct breakwatch {
 	struct breakwatch *next;
 	enum target_breakwatch type;
 	target_addr addr;
 	size_t size;
+	struct breakwatch_cond *cond; /* stop if any condition is true */
+	uint32_t hits;
+	uint32_t ignore;
 	uint32_t reserved[4]; /* for use by the implementing driver */
 };
 
@@ -86,12 +111,22 @@ struct target_s {
 	                 size_t len);
 	void (*mem_write)(target *t, target_addr dest,
 	                  const void *src, size_t len);
+	int (*crc32)(target *t, target_addr addr, size_t len, uint32_t *crc);
+	struct target_mem_cache *mem_cache;
+	bool mem_cache_off;
+	bool flash_diff_off;
+	/* Mass erase a bank when a load erases this much of it, 0 is off */
+	uint8_t flash_mass_erase_pct;
+	bool flash_plan_pending;
+	/* Bumped by target_flash_done(), for state kept per flash session */
+	uint32_t flash_session;
 
 	/* Register access functions */
 	size_t regs_size;
 	const char *tdesc;
 	void (*regs_read)(target *t, void *data);
 	void (*regs_write)(target *t, const void *data);
+	ssize_t (*reg_read)(target *t, int reg, void *data, size_t max);
 
 	/* Halt/resume functions */
 	void (*reset)(target *t);
@@ -99,6 +134,10 @@ struct target_s {
 	void (*halt_request)(target *t);
 	enum target_halt_reason (*halt_poll)(target *t, target_addr *watch);
 	void (*halt_resume)(target *t, bool step);
+	/* Set by halt_poll while the running core sleeps in WFI/WFE */
+	bool sleeping;
+	/* Halted as last seen through target_halt_poll() */
+	bool halted;
 
 	/* Break-/watchpoint functions */
 	int (*breakwatch_set)(target *t, struct breakwatch*);
@@ -137,6 +176,7 @@ void target_mem_write32(target *t, uint32_t addr, uint32_t value);
 void target_mem_write16(target *t, uint32_t addr, uint16_t value);
 void target_mem_write8(target *t, uint32_t addr, uint8_t value);
 bool target_check_error(target *t);
+bool target_breakwatch_check(target *t, target_addr addr);
 
 /* Access to host controller interface */
 void tc_printf(target *t, const char *fmt, ...);